@@ -0,0 +1,27 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_ALLOCATION_COUNTER_HPP
+#define CSP_TRAJECTORIES_ALLOCATION_COUNTER_HPP
+
+#include <cstdint>
+
+// The csp-trajectories-allocation-counter library replaces the global operator new and counts all
+// calls per thread. It is only built if the CMake option CSP_TRAJECTORIES_COUNT_ALLOCATIONS is
+// enabled. The replacement is only used if the library is preloaded, for example with
+//
+//   LD_PRELOAD=libcsp-trajectories-allocation-counter.so ./cosmoscout
+//
+// as otherwise the operator new of the C++ standard library takes precedence. Without preloading,
+// the count never changes.
+
+extern "C" {
+
+/// Returns the number of heap allocations which have been made by the calling thread so far.
+uint64_t cspTrajectoriesGetAllocationCount();
+}
+
+#endif // CSP_TRAJECTORIES_ALLOCATION_COUNTER_HPP
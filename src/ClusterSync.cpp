@@ -0,0 +1,202 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "ClusterSync.hpp"
+
+#include "logger.hpp"
+
+#include <VistaInterProcComm/Cluster/VistaClusterDataSync.h>
+#include <VistaKernel/Cluster/VistaClusterMode.h>
+#include <VistaKernel/VistaSystem.h>
+#include <cstring>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// The leader and the followers run the same binary on the same kind of hardware, so all values
+// are simply copied with their native representation.
+template <typename T>
+void write(std::vector<VistaType::byte>& buffer, T const& value) {
+  size_t offset = buffer.size();
+  buffer.resize(offset + sizeof(T));
+  std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+void write(std::vector<VistaType::byte>& buffer, std::vector<T> const& values) {
+  write(buffer, static_cast<uint32_t>(values.size()));
+  size_t offset = buffer.size();
+  buffer.resize(offset + values.size() * sizeof(T));
+  std::memcpy(buffer.data() + offset, values.data(), values.size() * sizeof(T));
+}
+
+void write(std::vector<VistaType::byte>& buffer, std::string const& value) {
+  write(buffer, static_cast<uint32_t>(value.size()));
+  buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+class Reader {
+ public:
+  explicit Reader(std::vector<VistaType::byte> const& buffer)
+      : mBuffer(buffer) {
+  }
+
+  template <typename T>
+  bool read(T& value) {
+    if (mOffset + sizeof(T) > mBuffer.size()) {
+      return false;
+    }
+    std::memcpy(&value, mBuffer.data() + mOffset, sizeof(T));
+    mOffset += sizeof(T);
+    return true;
+  }
+
+  template <typename T>
+  bool read(std::vector<T>& values) {
+    uint32_t count{};
+    if (!read(count) || mOffset + count * sizeof(T) > mBuffer.size()) {
+      return false;
+    }
+    values.resize(count);
+    std::memcpy(values.data(), mBuffer.data() + mOffset, count * sizeof(T));
+    mOffset += count * sizeof(T);
+    return true;
+  }
+
+  bool read(std::string& value) {
+    uint32_t length{};
+    if (!read(length) || mOffset + length > mBuffer.size()) {
+      return false;
+    }
+    value.assign(reinterpret_cast<char const*>(mBuffer.data() + mOffset), length);
+    mOffset += length;
+    return true;
+  }
+
+ private:
+  std::vector<VistaType::byte> const& mBuffer;
+  size_t                              mOffset = 0;
+};
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ClusterSync::ClusterSync()
+    : mDataSync(GetVistaSystem()->GetClusterMode()->CreateDataSync())
+    , mIsLeader(GetVistaSystem()->GetClusterMode()->GetIsLeader()) {
+
+  logger().info("Trail samples are computed on the {} node and synchronized to all other nodes.",
+      mIsLeader ? "this" : "leader");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ClusterSync::~ClusterSync() {
+  for (auto const& weak : mSyncedTrajectories) {
+    if (auto trajectory = weak.lock()) {
+      trajectory->setExternalSampling(false);
+      trajectory->setRecordChanges(false);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ClusterSync::update(double                                          tTime,
+    std::unordered_map<std::string, std::shared_ptr<Trajectory>> const& trajectories) {
+
+  mSyncedTrajectories.clear();
+  mBuffer.clear();
+
+  if (mIsLeader) {
+    write(mBuffer, static_cast<uint32_t>(trajectories.size()));
+
+    for (auto const& [name, trajectory] : trajectories) {
+      trajectory->setExternalSampling(true);
+      trajectory->setRecordChanges(true);
+
+      // Trails which moved less than the pixel threshold or which are evicted are not sampled. The
+      // changes are sent nevertheless, so that the followers evict the same trails.
+      if (trajectory->needsSampling(tTime)) {
+        trajectory->updateSamples(tTime);
+      }
+
+      trajectory->takeChanges(mChanges);
+
+      write(mBuffer, name);
+      write(mBuffer, mChanges.mCapacity);
+      write(mBuffer, mChanges.mStartIndex);
+      write(mBuffer, mChanges.mHasVelocities);
+      write(mBuffer, mChanges.mHasTip);
+      write(mBuffer, mChanges.mIsEvicted);
+      write(mBuffer, mChanges.mTip);
+      write(mBuffer, mChanges.mVisibleRadius);
+      write(mBuffer, mChanges.mSlots);
+      write(mBuffer, mChanges.mPoints);
+      write(mBuffer, mChanges.mVelocities);
+
+      mSyncedTrajectories.push_back(trajectory);
+    }
+  }
+
+  // On the leader, this sends the buffer to all followers. On the followers, this blocks until the
+  // buffer of the leader has been received.
+  if (!mDataSync->SyncData(mBuffer)) {
+    logger().warn("Failed to synchronize trail samples!");
+    return;
+  }
+
+  if (mIsLeader) {
+    return;
+  }
+
+  for (auto const& trajectory : trajectories) {
+    trajectory.second->setExternalSampling(true);
+    mSyncedTrajectories.push_back(trajectory.second);
+  }
+
+  Reader   reader(mBuffer);
+  uint32_t count{};
+
+  if (!reader.read(count)) {
+    logger().warn("Received invalid trail samples!");
+    return;
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    std::string name;
+
+    if (!reader.read(name) || !reader.read(mChanges.mCapacity) ||
+        !reader.read(mChanges.mStartIndex) || !reader.read(mChanges.mHasVelocities) ||
+        !reader.read(mChanges.mHasTip) || !reader.read(mChanges.mIsEvicted) ||
+        !reader.read(mChanges.mTip) ||
+        !reader.read(mChanges.mVisibleRadius) || !reader.read(mChanges.mSlots) ||
+        !reader.read(mChanges.mPoints) || !reader.read(mChanges.mVelocities) ||
+        mChanges.mSlots.size() != mChanges.mPoints.size()) {
+      logger().warn("Received invalid trail samples!");
+      return;
+    }
+
+    auto trajectory = trajectories.find(name);
+    if (trajectory != trajectories.end()) {
+      trajectory->second->applyChanges(mChanges);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ClusterSync::getIsLeader() const {
+  return mIsLeader;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
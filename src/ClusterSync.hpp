@@ -0,0 +1,59 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_CLUSTER_SYNC_HPP
+#define CSP_TRAJECTORIES_CLUSTER_SYNC_HPP
+
+#include "Trajectory.hpp"
+
+#include <VistaBase/VistaBaseTypes.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class IVistaClusterDataSync;
+
+namespace csp::trajectories {
+
+/// In a cluster setup, the ClusterSync makes sure that trails are only sampled on the leader node.
+/// Each frame, the leader evaluates all new samples and sends them to all follower nodes which
+/// apply them without evaluating any ephemeris data themselves. Only samples which changed since
+/// the last frame are sent.
+class ClusterSync {
+ public:
+  ClusterSync();
+
+  ClusterSync(ClusterSync const& other) = delete;
+  ClusterSync(ClusterSync&& other)      = delete;
+
+  ClusterSync& operator=(ClusterSync const& other) = delete;
+  ClusterSync& operator=(ClusterSync&& other) = delete;
+
+  /// Restores local sampling for all trajectories which were synchronized.
+  ~ClusterSync();
+
+  /// This has to be called once per frame on all nodes before the trajectories are updated by the
+  /// SolarSystem. The given map has to contain the same trajectories on all nodes.
+  void update(double                                                  tTime,
+      std::unordered_map<std::string, std::shared_ptr<Trajectory>> const& trajectories);
+
+  /// Only the leader decides which trails are evicted, the followers evict the same trails when
+  /// they receive the changes of the next frame.
+  bool getIsLeader() const;
+
+ private:
+  std::unique_ptr<IVistaClusterDataSync> mDataSync;
+  bool                                   mIsLeader = true;
+
+  std::vector<std::weak_ptr<Trajectory>> mSyncedTrajectories;
+  std::vector<VistaType::byte>           mBuffer;
+  Trajectory::Changes                    mChanges;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_CLUSTER_SYNC_HPP
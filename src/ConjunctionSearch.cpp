@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "ConjunctionSearch.hpp"
+
+#include "Trajectory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <tuple>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// FNV-1a hash of the given sample.
+uint64_t hash(glm::dvec4 const& sample, uint64_t value) {
+  std::array<unsigned char, sizeof(glm::dvec4)> bytes{};
+  std::memcpy(bytes.data(), &sample, sizeof(glm::dvec4));
+
+  for (unsigned char byte : bytes) {
+    value = (value ^ byte) * 1099511628211ULL;
+  }
+
+  return value;
+}
+
+const uint64_t HASH_SEED = 14695981039346656037ULL;
+
+bool isFinite(glm::dvec4 const& sample) {
+  return std::isfinite(sample.x) && std::isfinite(sample.y) && std::isfinite(sample.z) &&
+         std::isfinite(sample.w);
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::setDistance(double distance) {
+  if (distance != mDistance) {
+    mDistance = distance;
+    reset();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::setBucketDuration(double duration) {
+  if (duration != mBucketDuration) {
+    mBucketDuration = duration;
+    reset();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ConjunctionSearch::update(
+    std::unordered_map<std::string, std::shared_ptr<Trajectory>> const& trajectories) {
+
+  if (mDistance <= 0.0 || mBucketDuration <= 0.0) {
+    return false;
+  }
+
+  // Remove trails which do not exist anymore. Their ids are reused for new trails.
+  for (auto trail = mTrails.begin(); trail != mTrails.end();) {
+    if (trajectories.find(trail->first) == trajectories.end()) {
+      removeTrail(trail->second);
+      mTrailNames[trail->second.mId].clear();
+      mFreeTrailIds.push_back(trail->second.mId);
+      trail = mTrails.erase(trail);
+    } else {
+      ++trail;
+    }
+  }
+
+  // Unused ids at the end are dropped, so that the list of names shrinks again.
+  while (!mTrailNames.empty() && mTrailNames.back().empty()) {
+    mTrailNames.pop_back();
+  }
+
+  mFreeTrailIds.erase(std::remove_if(mFreeTrailIds.begin(), mFreeTrailIds.end(),
+                          [this](uint32_t id) { return id >= mTrailNames.size(); }),
+      mFreeTrailIds.end());
+
+  // Update all trails whose samples changed.
+  for (auto const& [name, trajectory] : trajectories) {
+    auto [trail, inserted] = mTrails.try_emplace(name);
+
+    if (inserted && !mFreeTrailIds.empty()) {
+      trail->second.mId = mFreeTrailIds.back();
+      mFreeTrailIds.pop_back();
+      mTrailNames[trail->second.mId] = name;
+    } else if (inserted) {
+      trail->second.mId = static_cast<uint32_t>(mTrailNames.size());
+      mTrailNames.push_back(name);
+    } else if (trail->second.mGeneration == trajectory->getGeneration()) {
+      continue;
+    }
+
+    auto view  = trajectory->getView();
+    auto group = mGroups
+                     .try_emplace(view.mParentCenter + "|" + view.mParentFrame,
+                         static_cast<uint32_t>(mGroups.size()))
+                     .first->second;
+
+    // If the parent of the trail changed, all its segments have to be moved to other buckets.
+    if (!inserted && group != trail->second.mGroup) {
+      removeTrail(trail->second);
+      trail->second.mBucketHashes.clear();
+    }
+
+    trail->second.mGroup      = group;
+    trail->second.mGeneration = view.mGeneration;
+    updateTrail(trail->second, view);
+  }
+
+  // Search all buckets again whose segments changed.
+  bool changed = false;
+
+  for (auto bucket = mBuckets.begin(); bucket != mBuckets.end();) {
+    if (bucket->second.mIsDirty) {
+      searchBucket(bucket->second);
+      changed = true;
+    }
+
+    if (bucket->second.mSegments.empty()) {
+      bucket = mBuckets.erase(bucket);
+    } else {
+      ++bucket;
+    }
+  }
+
+  if (changed) {
+    collectConjunctions();
+  }
+
+  return changed;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::vector<Plugin::Conjunction> const& ConjunctionSearch::getConjunctions() const {
+  return mConjunctions;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::reset() {
+  mTrails.clear();
+  mTrailNames.clear();
+  mFreeTrailIds.clear();
+  mGroups.clear();
+  mBuckets.clear();
+  mConjunctions.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::updateTrail(Trail& trail, Plugin::TrailView const& view) {
+
+  // Collect all segments between consecutive valid samples. Samples which are out of order are
+  // skipped.
+  mSegments.clear();
+
+  glm::dvec4 const* previous = nullptr;
+
+  for (auto const& span : {view.mOlder, view.mNewer}) {
+    for (size_t i = 0; i < span.mSize; ++i) {
+      glm::dvec4 const& sample = span.mData[i];
+
+      if (!isFinite(sample) || (previous && sample.w <= previous->w)) {
+        continue;
+      }
+
+      if (previous) {
+        mSegments.push_back({trail.mId, *previous, sample});
+      }
+
+      previous = &sample;
+    }
+  }
+
+  auto getFirstBucket = [this](Segment const& s) {
+    return static_cast<int64_t>(std::floor(s.mStart.w / mBucketDuration));
+  };
+
+  auto getLastBucket = [this](Segment const& s) {
+    return static_cast<int64_t>(std::floor(s.mEnd.w / mBucketDuration));
+  };
+
+  // Hash the segments of each bucket.
+  mNewHashes.clear();
+
+  for (auto const& segment : mSegments) {
+    for (int64_t b = getFirstBucket(segment); b <= getLastBucket(segment); ++b) {
+      auto [value, inserted] = mNewHashes.try_emplace(b, HASH_SEED);
+      value->second          = hash(segment.mEnd, hash(segment.mStart, value->second));
+    }
+  }
+
+  auto hasChanged = [&trail, this](int64_t b) {
+    auto oldHash = trail.mBucketHashes.find(b);
+    auto newHash = mNewHashes.find(b);
+    return oldHash == trail.mBucketHashes.end() || newHash == mNewHashes.end() ||
+           oldHash->second != newHash->second;
+  };
+
+  // Remove the old segments from all buckets which changed.
+  for (auto const& [b, value] : trail.mBucketHashes) {
+    if (hasChanged(b)) {
+      removeSegments(trail, b);
+    }
+  }
+
+  // Then add the new segments to these buckets.
+  for (auto const& segment : mSegments) {
+    for (int64_t b = getFirstBucket(segment); b <= getLastBucket(segment); ++b) {
+      if (hasChanged(b)) {
+        auto& bucket = mBuckets[{trail.mGroup, b}];
+        bucket.mSegments.push_back(segment);
+        bucket.mIsDirty = true;
+      }
+    }
+  }
+
+  trail.mBucketHashes.swap(mNewHashes);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::removeTrail(Trail const& trail) {
+  for (auto const& [b, value] : trail.mBucketHashes) {
+    removeSegments(trail, b);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::removeSegments(Trail const& trail, int64_t b) {
+  auto bucket = mBuckets.find({trail.mGroup, b});
+
+  if (bucket == mBuckets.end()) {
+    return;
+  }
+
+  auto& segments = bucket->second.mSegments;
+  segments.erase(std::remove_if(segments.begin(), segments.end(),
+                     [&trail](Segment const& s) { return s.mTrail == trail.mId; }),
+      segments.end());
+  bucket->second.mIsDirty = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::searchBucket(Bucket& bucket) {
+  bucket.mApproaches.clear();
+  bucket.mIsDirty = false;
+
+  auto const& segments = bucket.mSegments;
+
+  // The boxes are inflated by half the distance, so that segments which are closer than the
+  // distance have overlapping boxes.
+  double margin = mDistance * 0.5;
+
+  auto getMin = [margin](Segment const& s) {
+    return glm::min(glm::dvec3(s.mStart), glm::dvec3(s.mEnd)) - margin;
+  };
+
+  auto getMax = [margin](Segment const& s) {
+    return glm::max(glm::dvec3(s.mStart), glm::dvec3(s.mEnd)) + margin;
+  };
+
+  // Sweep-and-prune along the x-axis.
+  mOrder.resize(segments.size());
+  for (size_t i = 0; i < segments.size(); ++i) {
+    mOrder[i] = i;
+  }
+
+  std::sort(mOrder.begin(), mOrder.end(),
+      [&](size_t a, size_t b) { return getMin(segments[a]).x < getMin(segments[b]).x; });
+
+  for (size_t i = 0; i < mOrder.size(); ++i) {
+    Segment const& a    = segments[mOrder[i]];
+    glm::dvec3     minA = getMin(a);
+    glm::dvec3     maxA = getMax(a);
+
+    for (size_t j = i + 1; j < mOrder.size(); ++j) {
+      Segment const& b    = segments[mOrder[j]];
+      glm::dvec3     minB = getMin(b);
+
+      if (minB.x > maxA.x) {
+        break;
+      }
+
+      if (a.mTrail == b.mTrail) {
+        continue;
+      }
+
+      glm::dvec3 maxB = getMax(b);
+
+      if (minB.y > maxA.y || minA.y > maxB.y || minB.z > maxA.z || minA.z > maxB.z) {
+        continue;
+      }
+
+      // Both targets move linearly during the common time interval of the segments, so their
+      // offset does as well.
+      double t0 = std::max(a.mStart.w, b.mStart.w);
+      double t1 = std::min(a.mEnd.w, b.mEnd.w);
+
+      if (t0 > t1) {
+        continue;
+      }
+
+      auto getPosition = [](Segment const& s, double t) {
+        double alpha = (t - s.mStart.w) / (s.mEnd.w - s.mStart.w);
+        return glm::mix(glm::dvec3(s.mStart), glm::dvec3(s.mEnd), alpha);
+      };
+
+      glm::dvec3 offset   = getPosition(a, t0) - getPosition(b, t0);
+      glm::dvec3 motion   = getPosition(a, t1) - getPosition(b, t1) - offset;
+      double     mm       = glm::dot(motion, motion);
+      double     alpha    = mm > 0.0 ? glm::clamp(-glm::dot(offset, motion) / mm, 0.0, 1.0) : 0.0;
+      double     distance = glm::length(offset + alpha * motion);
+
+      if (distance > mDistance) {
+        continue;
+      }
+
+      // Only the closest approach of each pair of trails is kept per bucket.
+      Approach result = {std::min(a.mTrail, b.mTrail), std::max(a.mTrail, b.mTrail),
+          t0 + alpha * (t1 - t0), distance};
+
+      auto approach = std::find_if(bucket.mApproaches.begin(), bucket.mApproaches.end(),
+          [&](Approach const& x) {
+            return x.mTrailA == result.mTrailA && x.mTrailB == result.mTrailB;
+          });
+
+      if (approach == bucket.mApproaches.end()) {
+        bucket.mApproaches.push_back(result);
+      } else if (distance < approach->mDistance) {
+        *approach = result;
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ConjunctionSearch::collectConjunctions() {
+  std::vector<Approach> approaches;
+
+  for (auto const& [key, bucket] : mBuckets) {
+    approaches.insert(approaches.end(), bucket.mApproaches.begin(), bucket.mApproaches.end());
+  }
+
+  std::sort(approaches.begin(), approaches.end(), [](Approach const& a, Approach const& b) {
+    return std::tie(a.mTrailA, a.mTrailB, a.mTime) < std::tie(b.mTrailA, b.mTrailB, b.mTime);
+  });
+
+  // Each bucket only contains the closest approach of each pair of trails. Hence an approach close
+  // to the border of two buckets may be found in both of them, and two approaches in neighbouring
+  // buckets cannot be told apart from such a duplicate. Therefore, all approaches of a pair of
+  // trails which follow each other within one bucket duration are merged into the closest one.
+  mConjunctions.clear();
+
+  for (size_t i = 0; i < approaches.size();) {
+    Approach const* closest = &approaches[i];
+    size_t          next    = i + 1;
+
+    while (next < approaches.size() && approaches[next].mTrailA == closest->mTrailA &&
+           approaches[next].mTrailB == closest->mTrailB &&
+           approaches[next].mTime - approaches[next - 1].mTime <= mBucketDuration) {
+      if (approaches[next].mDistance < closest->mDistance) {
+        closest = &approaches[next];
+      }
+      ++next;
+    }
+
+    mConjunctions.push_back({mTrailNames[closest->mTrailA], mTrailNames[closest->mTrailB],
+        closest->mTime, closest->mDistance});
+
+    i = next;
+  }
+
+  std::sort(mConjunctions.begin(), mConjunctions.end(),
+      [](Plugin::Conjunction const& a, Plugin::Conjunction const& b) { return a.mTime < b.mTime; });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
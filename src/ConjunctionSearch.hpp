@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_CONJUNCTION_SEARCH_HPP
+#define CSP_TRAJECTORIES_CONJUNCTION_SEARCH_HPP
+
+#include "Plugin.hpp"
+
+#include <glm/glm.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace csp::trajectories {
+
+class Trajectory;
+
+/// The ConjunctionSearch finds close approaches between the samples of all trails. Trails can only
+/// be compared if their samples are given relative to the same parent center and frame, so each
+/// such combination forms a separate group. Between two samples, the targets are assumed to move
+/// linearly.
+///
+/// The segments between consecutive samples are sorted into time buckets of a fixed duration. Each
+/// segment is inserted into all buckets it overlaps. Within a bucket, candidate pairs are found by
+/// sweep-and-prune along the x-axis with the bounding boxes of the segments, inflated by the
+/// distance threshold. For each candidate, the time of closest approach is computed analytically
+/// on the common time interval of both segments.
+///
+/// The search works incrementally: for each trail, a hash of its segments in each bucket is
+/// stored. When a trail changes, only the buckets whose hash changed are searched again. Usually,
+/// these are the buckets at the start and at the end of the trail.
+class ConjunctionSearch {
+ public:
+  /// The distance is in meters, the bucket duration in seconds. If any of them changes, the
+  /// search starts from scratch.
+  void setDistance(double distance);
+  void setBucketDuration(double duration);
+
+  /// Updates the index with the current samples of all trajectories and searches all changed
+  /// buckets again. Returns true if the list of conjunctions changed.
+  bool update(std::unordered_map<std::string, std::shared_ptr<Trajectory>> const& trajectories);
+
+  /// All close approaches which are closer than the distance threshold, sorted by time. For each
+  /// pair of trails, approaches which are at most one bucket duration apart are merged into the
+  /// closest of them.
+  std::vector<Plugin::Conjunction> const& getConjunctions() const;
+
+ private:
+  /// A segment between two consecutive samples. xyz is the position, w the time.
+  struct Segment {
+    uint32_t   mTrail{};
+    glm::dvec4 mStart{};
+    glm::dvec4 mEnd{};
+  };
+
+  /// The closest approach of two trails within a bucket.
+  struct Approach {
+    uint32_t mTrailA{};
+    uint32_t mTrailB{};
+    double   mTime{};
+    double   mDistance{};
+  };
+
+  struct Bucket {
+    std::vector<Segment>  mSegments;
+    std::vector<Approach> mApproaches;
+    bool                  mIsDirty = false;
+  };
+
+  /// Buckets are identified by the group of the trails and the index of their time interval.
+  using BucketKey = std::pair<uint32_t, int64_t>;
+
+  struct Trail {
+    uint32_t                    mId{};
+    uint32_t                    mGroup{};
+    uint64_t                    mGeneration{};
+    std::map<int64_t, uint64_t> mBucketHashes;
+  };
+
+  void reset();
+  void updateTrail(Trail& trail, Plugin::TrailView const& view);
+  void removeTrail(Trail const& trail);
+  void removeSegments(Trail const& trail, int64_t bucket);
+  void searchBucket(Bucket& bucket);
+  void collectConjunctions();
+
+  double mDistance       = 0.0;
+  double mBucketDuration = 0.0;
+
+  std::unordered_map<std::string, Trail>    mTrails;
+  std::vector<std::string>                  mTrailNames;
+  std::vector<uint32_t>                     mFreeTrailIds;
+  std::unordered_map<std::string, uint32_t> mGroups;
+  std::map<BucketKey, Bucket>               mBuckets;
+  std::vector<Plugin::Conjunction>          mConjunctions;
+
+  // These are kept to reuse their memory.
+  std::vector<Segment>        mSegments;
+  std::map<int64_t, uint64_t> mNewHashes;
+  std::vector<size_t>         mOrder;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_CONJUNCTION_SEARCH_HPP
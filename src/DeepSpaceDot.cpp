@@ -16,6 +16,7 @@
 #include <VistaKernelOpenSGExt/VistaOpenSGMaterialTools.h>
 
 #include <glm/gtc/type_ptr.hpp>
+#include <string>
 #include <utility>
 
 namespace csp::trajectories {
@@ -26,16 +27,16 @@ const char* DeepSpaceDot::QUAD_VERT = R"(
 #version 330
 
 out vec2 vTexCoords;
-out float fDepth;
 
 uniform float uAspect;
+uniform float uFarClip;
 uniform mat4 uMatModelView;
 uniform mat4 uMatProjection;
 
 void main()
 {
     vec4 pos = uMatModelView * vec4(0, 0, 0, 1);
-    fDepth = length(pos.xyz);
+    float depth = length(pos.xyz);
 
     pos = uMatProjection * pos;
 
@@ -49,7 +50,10 @@ void main()
     float h = 0.0075;
     float w = h / uAspect;
 
-    pos.z = 0.9999999;
+    // The depth is the same for all four corners, so it can be written here instead of in the
+    // fragment shader. This keeps early depth tests enabled. Substract a small value to prevent
+    // depth fighting with trajectories.
+    pos.z = 2.0 * (depth / uFarClip - 0.00001) - 1.0;
 
     switch (gl_VertexID) {
         case 0:
@@ -80,26 +84,32 @@ const char* DeepSpaceDot::QUAD_FRAG = R"(
 #version 330
 
 uniform vec3 uCcolor;
-uniform float uFarClip;
 
 in vec2 vTexCoords;
-in float fDepth;
 
 layout(location = 0) out vec4 oColor;
 
 void main()
 {
-    float dist = length(vTexCoords);
-    float blob = pow(dist, 10.0);
-    oColor  = mix(vec4(uCcolor, 1.0), vec4(0), blob);
-    
-    // substract a small value to prevent depth fighting with trajectories
-    gl_FragDepth = fDepth / uFarClip - 0.00001;
+    // pow(dist, 10.0) without the pow()
+    float dist2 = dot(vTexCoords, vTexCoords);
+    float dist4 = dist2 * dist2;
+    float blob  = min(1.0, dist4 * dist4 * dist2);
+    oColor      = vec4(uCcolor, 1.0 - blob);
 }
 )";
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+// The name of the frame timer. It is created once, so that drawing does not allocate memory.
+const std::string TIMER_NAME = "Planet Marks";
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 DeepSpaceDot::DeepSpaceDot(std::shared_ptr<Plugin::Settings> pluginSettings,
     std::string const& sCenterName, std::string const& sFrameName, double tStartExistence,
     double tEndExistence)
@@ -127,8 +137,11 @@ DeepSpaceDot::~DeepSpaceDot() {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 bool DeepSpaceDot::Do() {
-  if (mPluginSettings->mEnablePlanetMarks.get() && getIsInExistence() && pVisible.get()) {
-    cs::utils::FrameTimings::ScopedTimer timer("Planet Marks");
+  // If clustering is enabled, all dots are drawn by the DeepSpaceDotClusters.
+  if (mPluginSettings->mEnablePlanetMarks.get() &&
+      !mPluginSettings->mEnablePlanetMarkClustering.get() && getIsInExistence() &&
+      pVisible.get()) {
+    cs::utils::FrameTimings::ScopedTimer timer(TIMER_NAME);
     // get viewport to draw dot with correct aspect ration
     std::array<GLint, 4> viewport{};
     glGetIntegerv(GL_VIEWPORT, viewport.data());
@@ -0,0 +1,345 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "DeepSpaceDotClusters.hpp"
+
+#include "DeepSpaceDot.hpp"
+
+#include "../../../src/cs-utils/FrameTimings.hpp"
+#include "../../../src/cs-utils/utils.hpp"
+
+#include <VistaKernel/GraphicsManager/VistaGraphicsManager.h>
+#include <VistaKernel/GraphicsManager/VistaSceneGraph.h>
+#include <VistaKernel/GraphicsManager/VistaTransformNode.h>
+#include <VistaKernel/VistaSystem.h>
+#include <VistaKernelOpenSGExt/VistaOpenSGMaterialTools.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <glm/gtc/type_ptr.hpp>
+#include <string>
+#include <utility>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char* DeepSpaceDotClusters::QUAD_VERT = R"(
+#version 330
+
+layout(location = 0) in vec4 iPosition;
+layout(location = 1) in vec2 iTexCoords;
+layout(location = 2) in vec3 iColor;
+
+out vec2 vTexCoords;
+out vec3 vColor;
+
+void main()
+{
+    vTexCoords  = iTexCoords;
+    vColor      = iColor;
+    gl_Position = iPosition;
+}
+)";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char* DeepSpaceDotClusters::QUAD_FRAG = R"(
+#version 330
+
+in vec2 vTexCoords;
+in vec3 vColor;
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+    // pow(dist, 10.0) without the pow()
+    float dist2 = dot(vTexCoords, vTexCoords);
+    float dist4 = dist2 * dist2;
+    float blob  = min(1.0, dist4 * dist4 * dist2);
+    oColor      = vec4(vColor, 1.0 - blob);
+}
+)";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Dots stay in their previous cell as long as they do not leave it by more than this fraction of
+// the cell size.
+const double CELL_MARGIN = 0.25;
+
+// Each cluster is drawn as two triangles with nine floats per vertex.
+const size_t FLOATS_PER_CLUSTER = 6 * 9;
+
+// The name of the frame timer. It is created once, so that drawing does not allocate memory.
+const std::string TIMER_NAME = "Planet Marks";
+
+// The offsets of the eight neighbours of a cell.
+const std::array<glm::ivec2, 8> NEIGHBOURS = {glm::ivec2(-1, -1), glm::ivec2(0, -1),
+    glm::ivec2(1, -1), glm::ivec2(-1, 0), glm::ivec2(1, 0), glm::ivec2(-1, 1), glm::ivec2(0, 1),
+    glm::ivec2(1, 1)};
+
+uint64_t getCellKey(glm::ivec2 const& cell) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(cell.x)) << 32U) |
+         static_cast<uint64_t>(static_cast<uint32_t>(cell.y));
+}
+
+glm::ivec2 getCell(uint64_t key) {
+  return glm::ivec2(static_cast<int32_t>(static_cast<uint32_t>(key >> 32U)),
+      static_cast<int32_t>(static_cast<uint32_t>(key & 0xFFFFFFFFU)));
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DeepSpaceDotClusters::DeepSpaceDotClusters(std::shared_ptr<Plugin::Settings> pluginSettings)
+    : mPluginSettings(std::move(pluginSettings)) {
+
+  mShader.InitVertexShaderFromString(QUAD_VERT);
+  mShader.InitFragmentShaderFromString(QUAD_FRAG);
+  mShader.Link();
+
+  mVAO.EnableAttributeArray(0);
+  mVAO.SpecifyAttributeArrayFloat(0, 4, GL_FLOAT, GL_FALSE, 9 * sizeof(float), 0, &mVBO);
+  mVAO.EnableAttributeArray(1);
+  mVAO.SpecifyAttributeArrayFloat(
+      1, 2, GL_FLOAT, GL_FALSE, 9 * sizeof(float), 4 * sizeof(float), &mVBO);
+  mVAO.EnableAttributeArray(2);
+  mVAO.SpecifyAttributeArrayFloat(
+      2, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(float), 6 * sizeof(float), &mVBO);
+
+  // Add to scenegraph.
+  VistaSceneGraph* pSG = GetVistaSystem()->GetGraphicsManager()->GetSceneGraph();
+  mGLNode.reset(pSG->NewOpenGLNode(pSG->GetRoot(), this));
+  VistaOpenSGMaterialTools::SetSortKeyOnSubtree(
+      mGLNode.get(), static_cast<int>(cs::utils::DrawOrder::eTransparentItems) - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DeepSpaceDotClusters::~DeepSpaceDotClusters() {
+  VistaSceneGraph* pSG = GetVistaSystem()->GetGraphicsManager()->GetSceneGraph();
+  pSG->GetRoot()->DisconnectChild(mGLNode.get());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DeepSpaceDotClusters::addDot(std::shared_ptr<DeepSpaceDot> dot) {
+  mDots.push_back(std::move(dot));
+  mDotStates.emplace_back();
+
+  // In the worst case, each dot is a cluster of its own. Reserving the memory here ensures that
+  // drawing does not allocate memory.
+  mProjectedDots.reserve(mDots.size());
+  mClusters.reserve(mDots.size());
+  mVertices.reserve(mDots.size() * FLOATS_PER_CLUSTER);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DeepSpaceDotClusters::removeDot(std::shared_ptr<DeepSpaceDot> const& dot) {
+  auto it = std::find(mDots.begin(), mDots.end(), dot);
+
+  if (it == mDots.end()) {
+    return;
+  }
+
+  // The order of the dots does not matter, so the last one is moved into the gap.
+  auto index        = static_cast<size_t>(it - mDots.begin());
+  mDots[index]      = std::move(mDots.back());
+  mDotStates[index] = mDotStates.back();
+  mDots.pop_back();
+  mDotStates.pop_back();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool DeepSpaceDotClusters::Do() {
+  if (!mPluginSettings->mEnablePlanetMarks.get() ||
+      !mPluginSettings->mEnablePlanetMarkClustering.get() || mDots.empty()) {
+    return true;
+  }
+
+  cs::utils::FrameTimings::ScopedTimer timer(TIMER_NAME);
+
+  std::array<GLint, 4> viewport{};
+  glGetIntegerv(GL_VIEWPORT, viewport.data());
+  double fAspect = 1.0 * viewport.at(2) / viewport.at(3);
+
+  std::array<GLfloat, 16> glMatMV{};
+  std::array<GLfloat, 16> glMatP{};
+  glGetFloatv(GL_MODELVIEW_MATRIX, glMatMV.data());
+  glGetFloatv(GL_PROJECTION_MATRIX, glMatP.data());
+  auto matV = glm::dmat4(glm::make_mat4x4(glMatMV.data()));
+  auto matP = glm::dmat4(glm::make_mat4x4(glMatP.data()));
+
+  double cellSize = std::max(1.0, mPluginSettings->mPlanetMarkClusterPixels.get());
+  double farClip  = cs::utils::getCurrentFarClipDistance();
+
+  mProjectedDots.clear();
+
+  // Project all dots to the screen and assign them to the grid cells.
+  for (size_t i = 0; i < mDots.size(); ++i) {
+    auto const& dot   = mDots[i];
+    auto&       state = mDotStates[i];
+
+    if (!dot->getIsInExistence() || !dot->pVisible.get()) {
+      state.mIsAssigned = false;
+      continue;
+    }
+
+    glm::dvec4 pos   = matV * dot->getWorldTransform()[3];
+    double     depth = glm::length(glm::dvec3(pos));
+
+    pos = matP * pos;
+
+    if (pos.w <= 0.0) {
+      state.mIsAssigned = false;
+      continue;
+    }
+
+    glm::dvec2 ndc   = glm::dvec2(pos.x, pos.y) / pos.w;
+    glm::dvec2 pixel = (ndc * 0.5 + 0.5) * glm::dvec2(viewport.at(2), viewport.at(3));
+
+    glm::dvec2 cellMin = glm::dvec2(state.mCell) * cellSize - CELL_MARGIN * cellSize;
+    glm::dvec2 cellMax = glm::dvec2(state.mCell + glm::ivec2(1)) * cellSize +
+                         CELL_MARGIN * cellSize;
+
+    if (!state.mIsAssigned || pixel.x < cellMin.x || pixel.y < cellMin.y ||
+        pixel.x > cellMax.x || pixel.y > cellMax.y) {
+      state.mCell       = glm::ivec2(glm::floor(pixel / cellSize));
+      state.mIsAssigned = true;
+    }
+
+    mProjectedDots.push_back({getCellKey(state.mCell), ndc,
+        glm::dvec3(dot->pColor.get()[0], dot->pColor.get()[1], dot->pColor.get()[2]), depth});
+  }
+
+  if (mProjectedDots.empty()) {
+    return true;
+  }
+
+  // After sorting, the dots of each cell are next to each other, so each run of dots becomes one
+  // cluster.
+  std::sort(mProjectedDots.begin(), mProjectedDots.end(),
+      [](ProjectedDot const& a, ProjectedDot const& b) { return a.mKey < b.mKey; });
+
+  mClusters.clear();
+
+  for (auto const& dot : mProjectedDots) {
+    if (mClusters.empty() || mClusters.back().mKey != dot.mKey) {
+      mClusters.push_back({dot.mKey, glm::dvec2(0.0), glm::dvec3(0.0), dot.mDepth, 0});
+    }
+
+    auto& cluster = mClusters.back();
+
+    // The closest dot determines the depth of the cluster.
+    cluster.mDepth = std::min(cluster.mDepth, dot.mDepth);
+    cluster.mPositionSum += dot.mPosition;
+    cluster.mColorSum += dot.mColor;
+    ++cluster.mCount;
+  }
+
+  // Dots on both sides of a cell border end up in different clusters, even if they are only a
+  // pixel apart. Hence each cluster absorbs the clusters of its neighbouring cells whose center is
+  // closer than one cell. The clusters are sorted by their key, so neighbours are found with a
+  // binary search. Absorbed clusters are left empty.
+  glm::dvec2 ndcToPixels = glm::dvec2(viewport.at(2), viewport.at(3)) * 0.5;
+
+  for (auto& cluster : mClusters) {
+    if (cluster.mCount == 0) {
+      continue;
+    }
+
+    glm::ivec2 cell = getCell(cluster.mKey);
+
+    for (auto const& offset : NEIGHBOURS) {
+      uint64_t key   = getCellKey(cell + offset);
+      auto     other = std::lower_bound(mClusters.begin(), mClusters.end(), key,
+          [](Cluster const& c, uint64_t k) { return c.mKey < k; });
+
+      if (other == mClusters.end() || other->mKey != key || other->mCount == 0) {
+        continue;
+      }
+
+      glm::dvec2 center      = cluster.mPositionSum / static_cast<double>(cluster.mCount);
+      glm::dvec2 otherCenter = other->mPositionSum / static_cast<double>(other->mCount);
+
+      if (glm::length((center - otherCenter) * ndcToPixels) < cellSize) {
+        cluster.mDepth = std::min(cluster.mDepth, other->mDepth);
+        cluster.mPositionSum += other->mPositionSum;
+        cluster.mColorSum += other->mColorSum;
+        cluster.mCount += other->mCount;
+        other->mCount = 0;
+      }
+    }
+  }
+
+  // Create one quad for each cluster. Clusters of many dots are drawn slightly bigger.
+  mVertices.clear();
+
+  for (auto const& cluster : mClusters) {
+    if (cluster.mCount == 0) {
+      continue;
+    }
+
+    glm::dvec2 center = cluster.mPositionSum / static_cast<double>(cluster.mCount);
+    glm::dvec3 color  = cluster.mColorSum / static_cast<double>(cluster.mCount);
+
+    double h = 0.0075 * (1.0 + 0.15 * std::log2(static_cast<double>(cluster.mCount)));
+    double w = h / fAspect;
+
+    // The depth is written in the vertex stage. As it is the same for all four corners, this
+    // gives the same result as writing gl_FragDepth but keeps early depth tests enabled.
+    // Substract a small value to prevent depth fighting with trajectories.
+    double z = 2.0 * (cluster.mDepth / farClip - 0.00001) - 1.0;
+
+    std::array<glm::dvec2, 6> const corners = {glm::dvec2(-1, 1), glm::dvec2(1, 1),
+        glm::dvec2(-1, -1), glm::dvec2(-1, -1), glm::dvec2(1, 1), glm::dvec2(1, -1)};
+
+    for (auto const& corner : corners) {
+      mVertices.insert(mVertices.end(),
+          {static_cast<float>(center.x + corner.x * w), static_cast<float>(center.y + corner.y * h),
+              static_cast<float>(z), 1.F, static_cast<float>(corner.x),
+              static_cast<float>(corner.y), static_cast<float>(color.r),
+              static_cast<float>(color.g), static_cast<float>(color.b)});
+    }
+  }
+
+  mVBO.Bind(GL_ARRAY_BUFFER);
+  mVBO.BufferData(
+      static_cast<GLsizeiptr>(mVertices.size() * sizeof(float)), mVertices.data(), GL_STREAM_DRAW);
+  mVBO.Release();
+
+  glEnable(GL_BLEND);
+  glDepthMask(GL_FALSE);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  mShader.Bind();
+  mVAO.Bind();
+  glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(mVertices.size() / 9));
+  mVAO.Release();
+  mShader.Release();
+
+  glDisable(GL_BLEND);
+  glDepthMask(GL_TRUE);
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool DeepSpaceDotClusters::GetBoundingBox(VistaBoundingBox& /*bb*/) {
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
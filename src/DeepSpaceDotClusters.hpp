@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_DEEP_SPACE_DOT_CLUSTERS_HPP
+#define CSP_TRAJECTORIES_DEEP_SPACE_DOT_CLUSTERS_HPP
+
+#include "Plugin.hpp"
+
+#include <VistaKernel/GraphicsManager/VistaOpenGLDraw.h>
+#include <VistaOGLExt/VistaBufferObject.h>
+#include <VistaOGLExt/VistaGLSLShader.h>
+#include <VistaOGLExt/VistaVertexArrayObject.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace csp::trajectories {
+
+class DeepSpaceDot;
+
+/// If planet mark clustering is enabled, the DeepSpaceDots do not draw themselves. Instead, this
+/// class projects all of them to the screen and merges dots whose projected positions fall into the
+/// same cell of a screen-space grid into one marker. Markers of neighbouring cells which are closer
+/// than one cell are merged as well. All markers are drawn with a single draw call, so the number
+/// of fragments is bounded by the screen size, regardless of the number of dots.
+///
+/// The assignment of dots to grid cells is kept from frame to frame: a dot only moves to another
+/// cell once it left its previous cell by a small margin. This prevents markers from flickering
+/// when a dot moves along a cell border.
+class DeepSpaceDotClusters : public IVistaOpenGLDraw {
+ public:
+  explicit DeepSpaceDotClusters(std::shared_ptr<Plugin::Settings> pluginSettings);
+
+  DeepSpaceDotClusters(DeepSpaceDotClusters const& other) = delete;
+  DeepSpaceDotClusters(DeepSpaceDotClusters&& other)      = delete;
+
+  DeepSpaceDotClusters& operator=(DeepSpaceDotClusters const& other) = delete;
+  DeepSpaceDotClusters& operator=(DeepSpaceDotClusters&& other) = delete;
+
+  ~DeepSpaceDotClusters() override;
+
+  /// Adds or removes a dot which should be clustered. The cell assignment of all other dots is
+  /// kept.
+  void addDot(std::shared_ptr<DeepSpaceDot> dot);
+  void removeDot(std::shared_ptr<DeepSpaceDot> const& dot);
+
+  bool Do() override;
+  bool GetBoundingBox(VistaBoundingBox& bb) override;
+
+ private:
+  struct DotState {
+    glm::ivec2 mCell{};
+    bool       mIsAssigned = false;
+  };
+
+  /// A dot which has been assigned to a grid cell in the current frame.
+  struct ProjectedDot {
+    uint64_t   mKey{};
+    glm::dvec2 mPosition{};
+    glm::dvec3 mColor{};
+    double     mDepth{};
+  };
+
+  struct Cluster {
+    uint64_t   mKey{};
+    glm::dvec2 mPositionSum{};
+    glm::dvec3 mColorSum{};
+    double     mDepth{};
+    int32_t    mCount{};
+  };
+
+  std::shared_ptr<Plugin::Settings>          mPluginSettings;
+  std::vector<std::shared_ptr<DeepSpaceDot>> mDots;
+  std::vector<DotState>                      mDotStates;
+  std::vector<ProjectedDot>                   mProjectedDots;
+  std::vector<Cluster>                       mClusters;
+  std::vector<float>                         mVertices;
+
+  VistaGLSLShader        mShader;
+  VistaBufferObject      mVBO;
+  VistaVertexArrayObject mVAO;
+
+  std::unique_ptr<VistaOpenGLNode> mGLNode;
+
+  static const char* QUAD_VERT;
+  static const char* QUAD_FRAG;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_DEEP_SPACE_DOT_CLUSTERS_HPP
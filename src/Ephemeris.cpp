@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "Ephemeris.hpp"
+
+#include "EphemerisWorkers.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cspice/SpiceUsr.h>
+#include <limits>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Smaller batches are evaluated locally if SPICE is not busy, as a round trip to the worker
+// processes takes longer than a few SPICE queries.
+const size_t MIN_WORKER_BATCH_SIZE = 128;
+
+std::shared_ptr<EphemerisWorkers> workers;
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Ephemeris::Ephemeris(
+    std::string sTargetCenter, std::string sObserverCenter, std::string sObserverFrame)
+    : mTargetCenter(std::move(sTargetCenter))
+    , mObserverCenter(std::move(sObserverCenter))
+    , mObserverFrame(std::move(sObserverFrame)) {
+  resolveIds();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Ephemeris::setTargetCenterName(std::string const& sCenterName) {
+  mTargetCenter = sCenterName;
+  resolveIds();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Ephemeris::setObserverCenterName(std::string const& sCenterName) {
+  mObserverCenter = sCenterName;
+  resolveIds();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Ephemeris::setObserverFrameName(std::string const& sFrameName) {
+  mObserverFrame = sFrameName;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::mutex& Ephemeris::getSpiceMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Ephemeris::setWorkers(std::shared_ptr<EphemerisWorkers> newWorkers) {
+  workers = std::move(newWorkers);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<Ephemeris::State> Ephemeris::getState(double tTime) const {
+  std::array<SpiceDouble, 6> state{};
+  SpiceDouble                lightTime{};
+
+  std::lock_guard<std::mutex> lock(getSpiceMutex());
+
+  spkezr_c(mTargetCenter.c_str(), tTime, mObserverFrame.c_str(), "NONE", mObserverCenter.c_str(),
+      state.data(), &lightTime);
+
+  if (failed_c()) {
+    reset_c();
+    return std::nullopt;
+  }
+
+  // SPICE uses kilometers, we use meters.
+  return State{glm::dvec3(state[0], state[1], state[2]) * 1000.0,
+      glm::dvec3(state[3], state[4], state[5]) * 1000.0};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Ephemeris::getPositions(double const* times, size_t count, glm::dvec3* positions) const {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+
+  if (!mIdsAreValid) {
+    std::fill(positions, positions + count, glm::dvec3(nan));
+    return;
+  }
+
+  // Large batches are always evaluated by the workers. Smaller ones only if another thread is
+  // currently using SPICE, so that sampling on multiple threads does not wait for the mutex.
+  std::unique_lock<std::mutex> lock(getSpiceMutex(), std::defer_lock);
+
+  if (evaluateOnWorkers(times, count, positions, nullptr, MIN_WORKER_BATCH_SIZE) ||
+      (!lock.try_lock() && evaluateOnWorkers(times, count, positions, nullptr, 1))) {
+    for (size_t i = 0; i < count; ++i) {
+      positions[i] *= 1000.0;
+    }
+    return;
+  }
+
+  if (!lock.owns_lock()) {
+    lock.lock();
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    SpiceDouble lightTime{};
+
+    spkezp_c(mTargetId, times[i], mObserverFrame.c_str(), "NONE", mObserverId,
+        &positions[i][0], &lightTime);
+
+    if (failed_c()) {
+      reset_c();
+      positions[i] = glm::dvec3(nan);
+    }
+  }
+
+  lock.unlock();
+
+  // SPICE uses kilometers, we use meters.
+  for (size_t i = 0; i < count; ++i) {
+    positions[i] *= 1000.0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Ephemeris::getStates(
+    double const* times, size_t count, glm::dvec3* positions, glm::dvec3* velocities) const {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+
+  if (!mIdsAreValid) {
+    std::fill(positions, positions + count, glm::dvec3(nan));
+    std::fill(velocities, velocities + count, glm::dvec3(nan));
+    return;
+  }
+
+  // See getPositions().
+  std::unique_lock<std::mutex> lock(getSpiceMutex(), std::defer_lock);
+
+  if (evaluateOnWorkers(times, count, positions, velocities, MIN_WORKER_BATCH_SIZE) ||
+      (!lock.try_lock() && evaluateOnWorkers(times, count, positions, velocities, 1))) {
+    for (size_t i = 0; i < count; ++i) {
+      positions[i] *= 1000.0;
+      velocities[i] *= 1000.0;
+    }
+    return;
+  }
+
+  if (!lock.owns_lock()) {
+    lock.lock();
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    std::array<SpiceDouble, 6> state{};
+    SpiceDouble                lightTime{};
+
+    spkez_c(mTargetId, times[i], mObserverFrame.c_str(), "NONE", mObserverId, state.data(),
+        &lightTime);
+
+    if (failed_c()) {
+      reset_c();
+      state.fill(nan);
+    }
+
+    positions[i]  = glm::dvec3(state[0], state[1], state[2]);
+    velocities[i] = glm::dvec3(state[3], state[4], state[5]);
+  }
+
+  lock.unlock();
+
+  // SPICE uses kilometers, we use meters.
+  for (size_t i = 0; i < count; ++i) {
+    positions[i] *= 1000.0;
+    velocities[i] *= 1000.0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Ephemeris::resolveIds() {
+  SpiceInt     targetId{};
+  SpiceInt     observerId{};
+  SpiceBoolean targetFound{};
+  SpiceBoolean observerFound{};
+
+  std::unique_lock<std::mutex> lock(getSpiceMutex());
+
+  bods2c_c(mTargetCenter.c_str(), &targetId, &targetFound);
+  bods2c_c(mObserverCenter.c_str(), &observerId, &observerFound);
+
+  if (failed_c()) {
+    reset_c();
+    targetFound = SPICEFALSE;
+  }
+
+  lock.unlock();
+
+  mTargetId    = static_cast<int>(targetId);
+  mObserverId  = static_cast<int>(observerId);
+  mIdsAreValid = targetFound && observerFound;
+
+  if (!mIdsAreValid) {
+    logger().warn("Failed to resolve the NAIF IDs of '{}' and '{}'!", mTargetCenter,
+        mObserverCenter);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Ephemeris::evaluateOnWorkers(double const* times, size_t count, glm::dvec3* positions,
+    glm::dvec3* velocities, size_t minBatchSize) const {
+
+  if (!workers || count < minBatchSize) {
+    return false;
+  }
+
+  return workers->evaluate(
+      mTargetId, mObserverId, mObserverFrame, times, count, positions, velocities);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
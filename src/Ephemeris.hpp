@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_EPHEMERIS_HPP
+#define CSP_TRAJECTORIES_EPHEMERIS_HPP
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace csp::trajectories {
+
+class EphemerisWorkers;
+
+/// The Ephemeris queries the SPICE toolkit for the state of a target body relative to an observing
+/// body in the observer's frame. As the anchors used for trails have no local offset, rotation or
+/// scale, the resulting position is the same as the one computed by
+/// cs::scene::CelestialAnchor::getRelativePosition(). In addition, the Ephemeris provides the
+/// velocity of the target. Positions are returned in meters, velocities in meters per second.
+///
+/// For sampling many times at once, the batched getPositions() and getStates() should be used.
+/// They resolve the body names only once and use the integer-based SPICE routines.
+///
+/// The SPICE toolkit is not thread-safe. All SPICE calls of the Ephemeris are therefore guarded by
+/// a global mutex, so that trails can be sampled on multiple threads. Other code which calls SPICE
+/// while trails may be sampled in parallel has to lock getSpiceMutex() as well.
+///
+/// If EphemerisWorkers are set, large batches are evaluated by the worker processes instead. They
+/// are not limited by the mutex. While another thread holds the mutex, smaller batches are sent to
+/// the workers as well, so that trails sampled on multiple threads are evaluated in parallel.
+class Ephemeris {
+ public:
+  /// The position and velocity of the target at a specific time.
+  struct State {
+    glm::dvec3 mPosition;
+    glm::dvec3 mVelocity;
+  };
+
+  Ephemeris(std::string sTargetCenter, std::string sObserverCenter, std::string sObserverFrame);
+
+  /// The mutex which guards all SPICE calls.
+  static std::mutex& getSpiceMutex();
+
+  /// Sets the worker processes which are used by all Ephemeris instances for large batches. Pass a
+  /// nullptr to evaluate everything in this process. This must not be called while other threads
+  /// use an Ephemeris.
+  static void setWorkers(std::shared_ptr<EphemerisWorkers> workers);
+
+  void setTargetCenterName(std::string const& sCenterName);
+  void setObserverCenterName(std::string const& sCenterName);
+  void setObserverFrameName(std::string const& sFrameName);
+
+  /// Returns std::nullopt if there is no data available for the given time.
+  std::optional<State> getState(double tTime) const;
+
+  /// Evaluates the position of the target at count times and writes them to positions. If there
+  /// is no data available for a time, the corresponding position is set to NaN.
+  void getPositions(double const* times, size_t count, glm::dvec3* positions) const;
+
+  /// Same as getPositions() but the velocities are evaluated as well.
+  void getStates(
+      double const* times, size_t count, glm::dvec3* positions, glm::dvec3* velocities) const;
+
+ private:
+  /// Looks up the NAIF IDs of the target and the observer. This is done whenever one of the names
+  /// changes.
+  void resolveIds();
+
+  /// Evaluates the batch on the worker processes, if there are any and the batch has at least
+  /// minBatchSize entries. The results are in kilometers. Returns false if the batch has to be
+  /// evaluated locally.
+  bool evaluateOnWorkers(double const* times, size_t count, glm::dvec3* positions,
+      glm::dvec3* velocities, size_t minBatchSize) const;
+
+  std::string mTargetCenter;
+  std::string mObserverCenter;
+  std::string mObserverFrame;
+
+  int  mTargetId{};
+  int  mObserverId{};
+  bool mIdsAreValid = false;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_EPHEMERIS_HPP
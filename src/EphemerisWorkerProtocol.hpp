@@ -0,0 +1,79 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_EPHEMERIS_WORKER_PROTOCOL_HPP
+#define CSP_TRAJECTORIES_EPHEMERIS_WORKER_PROTOCOL_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <semaphore.h>
+#include <sys/types.h>
+
+/// This file describes the shared memory which is used by the EphemerisWorkers of the plugin and
+/// by the csp-trajectories-ephemeris-worker processes. It is included by both, so it must not
+/// depend on anything else of the plugin.
+///
+/// The shared memory starts with a SharedState which is followed by SharedState::mBatchCount
+/// SharedBatches. The batches form a ring: the plugin fills free batches and marks them as
+/// requested, the workers evaluate them and mark them as done. The semaphore mWork counts the
+/// requested batches, the semaphore mDone of each batch is posted once it has been evaluated.
+namespace csp::trajectories::protocol {
+
+/// This is increased whenever the layout below changes.
+const uint32_t VERSION = 1;
+
+/// The maximum number of times in a single batch.
+const size_t BATCH_CAPACITY = 512;
+
+/// The maximum length of a frame name including the terminating zero.
+const size_t FRAME_NAME_LENGTH = 64;
+
+enum class BatchState : uint32_t {
+  eFree,       ///< The batch can be used for a new request.
+  eFilling,    ///< The plugin writes a request to the batch.
+  eRequested,  ///< The request waits for a worker.
+  eEvaluating, ///< A worker evaluates the request.
+  eDone        ///< The results can be read by the plugin.
+};
+
+struct alignas(64) SharedBatch {
+  std::atomic<BatchState> mState{BatchState::eFree};
+  sem_t                   mDone{};
+
+  int32_t                                mTargetId{};
+  int32_t                                mObserverId{};
+  std::array<char, FRAME_NAME_LENGTH>    mFrame{};
+  uint32_t                               mCount{};
+  bool                                   mWithVelocities{};
+  std::array<double, BATCH_CAPACITY>     mTimes{};
+  std::array<double, BATCH_CAPACITY * 6> mStates{}; ///< Position and velocity in km and km/s.
+};
+
+struct alignas(64) SharedState {
+  uint32_t              mVersion = VERSION;
+  pid_t                 mParentPid{};
+  uint32_t              mBatchCount{};
+  std::atomic<uint32_t> mReadyWorkers{0};
+  std::atomic<bool>     mShutdown{false};
+  std::atomic<uint32_t> mNextBatch{0};
+  sem_t                 mWork{};
+};
+
+/// Returns the number of bytes required for a shared state with the given number of batches.
+inline size_t getSharedSize(uint32_t batchCount) {
+  return sizeof(SharedState) + batchCount * sizeof(SharedBatch);
+}
+
+/// Returns the batch with the given index. The index has to be smaller than mBatchCount.
+inline SharedBatch& getBatch(SharedState& state, uint32_t index) {
+  auto* first = reinterpret_cast<char*>(&state) + sizeof(SharedState);
+  return *reinterpret_cast<SharedBatch*>(first + index * sizeof(SharedBatch));
+}
+
+} // namespace csp::trajectories::protocol
+
+#endif // CSP_TRAJECTORIES_EPHEMERIS_WORKER_PROTOCOL_HPP
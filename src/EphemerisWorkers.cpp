@@ -0,0 +1,433 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "EphemerisWorkers.hpp"
+
+#include "Ephemeris.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cspice/SpiceUsr.h>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+// The workers need POSIX shared memory and sem_timedwait(). The latter is not available on macOS.
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define CSP_TRAJECTORIES_WORKERS_SUPPORTED
+#endif
+
+#ifdef CSP_TRAJECTORIES_WORKERS_SUPPORTED
+#include "EphemerisWorkerProtocol.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// The name of the worker executable. It is installed next to the CosmoScout VR executable.
+const char* WORKER_EXECUTABLE = "csp-trajectories-ephemeris-worker";
+
+// Each worker can have this many batches in flight.
+const uint32_t BATCHES_PER_WORKER = 4;
+
+// Batches are not split into chunks smaller than this, as each chunk costs a round trip to a
+// worker.
+const size_t MIN_CHUNK_SIZE = 64;
+
+// If a worker does not answer within this time, it is considered to have crashed.
+const int RESPONSE_TIMEOUT = 10;
+
+// While waiting for an answer, the workers are checked for having exited in these intervals.
+const long WAIT_SLICE_NS = 100000000L;
+
+// A single call to evaluate() has at most this many chunks in flight.
+const size_t MAX_CHUNKS_IN_FLIGHT = 64;
+
+#ifdef CSP_TRAJECTORIES_WORKERS_SUPPORTED
+
+// Returns the number of all loaded kernels, including those loaded by meta-kernels.
+size_t getLoadedKernelCount() {
+  std::lock_guard<std::mutex> lock(Ephemeris::getSpiceMutex());
+
+  SpiceInt count = 0;
+  ktotal_c("ALL", &count);
+
+  return static_cast<size_t>(count);
+}
+
+// Returns the file names of all kernels which have been loaded directly, in the order in which
+// they have been loaded. Kernels which have been loaded by a meta-kernel are skipped, as the
+// workers load the meta-kernel itself. The number of all loaded kernels is stored in totalCount.
+std::vector<std::string> getLoadedKernels(size_t& totalCount) {
+  std::lock_guard<std::mutex> lock(Ephemeris::getSpiceMutex());
+
+  SpiceInt count = 0;
+  ktotal_c("ALL", &count);
+  totalCount = static_cast<size_t>(count);
+
+  std::vector<std::string> kernels;
+
+  for (SpiceInt i = 0; i < count; ++i) {
+    std::array<SpiceChar, 512> file{};
+    std::array<SpiceChar, 32>  type{};
+    std::array<SpiceChar, 512> source{};
+    SpiceInt                   handle{};
+    SpiceBoolean               found{};
+
+    kdata_c(i, "ALL", file.size(), type.size(), source.size(), file.data(), type.data(),
+        source.data(), &handle, &found);
+
+    if (found && source[0] == '\0') {
+      kernels.emplace_back(file.data());
+    }
+  }
+
+  return kernels;
+}
+
+// Waits until the given semaphore is posted. Returns false if one of the given worker processes
+// has exited or if this takes longer than RESPONSE_TIMEOUT. The semaphore is waited for in short
+// slices, so that a crashed worker is noticed quickly.
+bool waitFor(sem_t* semaphore, std::vector<int> const& pids) {
+  auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(RESPONSE_TIMEOUT);
+
+  while (true) {
+    timespec deadline{};
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += WAIT_SLICE_NS;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    if (sem_timedwait(semaphore, &deadline) == 0) {
+      return true;
+    }
+
+    if (errno == EINTR) {
+      continue;
+    }
+
+    if (errno != ETIMEDOUT || std::chrono::steady_clock::now() > timeout) {
+      return false;
+    }
+
+    // If another thread already reaped an exited worker, waitpid() fails instead of returning
+    // its pid. Both mean that the worker is gone.
+    for (int pid : pids) {
+      if (waitpid(pid, nullptr, WNOHANG) != 0) {
+        return false;
+      }
+    }
+  }
+}
+
+// Claims a free batch of the ring. Returns a nullptr if all batches are in use.
+protocol::SharedBatch* acquireBatch(protocol::SharedState& shared) {
+  uint32_t start = shared.mNextBatch.fetch_add(1);
+
+  for (uint32_t i = 0; i < shared.mBatchCount; ++i) {
+    auto& batch    = protocol::getBatch(shared, (start + i) % shared.mBatchCount);
+    auto  expected = protocol::BatchState::eFree;
+
+    if (batch.mState.compare_exchange_strong(expected, protocol::BatchState::eFilling)) {
+      return &batch;
+    }
+  }
+
+  return nullptr;
+}
+
+#endif
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+EphemerisWorkers::EphemerisWorkers(size_t workerCount)
+    : mWorkerCount(workerCount) {
+
+#ifndef CSP_TRAJECTORIES_WORKERS_SUPPORTED
+  logger().warn("Ephemeris worker processes are not supported on this platform!");
+  mFailed = true;
+#else
+  static std::atomic<uint32_t> instanceCounter{0};
+
+  mSharedName = "/csp-trajectories-" + std::to_string(getpid()) + "-" +
+                std::to_string(instanceCounter.fetch_add(1));
+
+  auto batchCount = static_cast<uint32_t>(mWorkerCount * BATCHES_PER_WORKER);
+  mSharedSize     = protocol::getSharedSize(batchCount);
+
+  int fd = shm_open(mSharedName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+  if (fd < 0 || ftruncate(fd, static_cast<off_t>(mSharedSize)) != 0) {
+    logger().warn("Failed to create shared memory for ephemeris workers: {}", std::strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+      shm_unlink(mSharedName.c_str());
+    }
+    mFailed = true;
+    return;
+  }
+
+  void* memory = mmap(nullptr, mSharedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (memory == MAP_FAILED) {
+    logger().warn("Failed to map shared memory for ephemeris workers: {}", std::strerror(errno));
+    shm_unlink(mSharedName.c_str());
+    mFailed = true;
+    return;
+  }
+
+  mShared              = new (memory) protocol::SharedState();
+  mShared->mParentPid  = getpid();
+  mShared->mBatchCount = batchCount;
+  sem_init(&mShared->mWork, 1, 0);
+
+  for (uint32_t i = 0; i < batchCount; ++i) {
+    auto* batch = new (&protocol::getBatch(*mShared, i)) protocol::SharedBatch();
+    sem_init(&batch->mDone, 1, 0);
+  }
+
+  // The workers get the name of the shared memory and all kernels to load on the command line.
+  std::error_code error;
+  auto executable = std::filesystem::read_symlink("/proc/self/exe", error).parent_path() /
+                    WORKER_EXECUTABLE;
+
+  if (error) {
+    executable = WORKER_EXECUTABLE;
+  }
+
+  std::vector<std::string> arguments{executable.string(), mSharedName};
+  for (auto& kernel : getLoadedKernels(mKernelCount)) {
+    arguments.push_back(std::move(kernel));
+  }
+
+  std::vector<char*> argv;
+  for (auto& argument : arguments) {
+    argv.push_back(argument.data());
+  }
+  argv.push_back(nullptr);
+
+  for (size_t i = 0; i < mWorkerCount; ++i) {
+    pid_t pid{};
+    int   result = posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+
+    if (result != 0) {
+      logger().warn("Failed to start ephemeris worker '{}': {}", argv[0], std::strerror(result));
+      mFailed = true;
+      return;
+    }
+
+    mPids.push_back(pid);
+  }
+
+  logger().info("Started {} ephemeris worker processes.", mWorkerCount);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+EphemerisWorkers::~EphemerisWorkers() {
+#ifdef CSP_TRAJECTORIES_WORKERS_SUPPORTED
+  if (!mShared) {
+    return;
+  }
+
+  mShared->mShutdown = true;
+
+  for (size_t i = 0; i < mPids.size(); ++i) {
+    sem_post(&mShared->mWork);
+  }
+
+  // Give the workers some time to finish their current batch before they are killed.
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+  for (int pid : mPids) {
+    while (waitpid(pid, nullptr, WNOHANG) == 0) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        break;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  for (uint32_t i = 0; i < mShared->mBatchCount; ++i) {
+    sem_destroy(&protocol::getBatch(*mShared, i).mDone);
+  }
+
+  sem_destroy(&mShared->mWork);
+  munmap(mShared, mSharedSize);
+  shm_unlink(mSharedName.c_str());
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t EphemerisWorkers::getWorkerCount() const {
+  return mWorkerCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool EphemerisWorkers::isAvailable() {
+#ifndef CSP_TRAJECTORIES_WORKERS_SUPPORTED
+  return false;
+#else
+  if (mFailed || !mShared) {
+    return false;
+  }
+
+  if (mShared->mReadyWorkers == mWorkerCount) {
+    return true;
+  }
+
+  // A worker which exits before it is ready, for example because it failed to load a kernel, will
+  // never become ready. The workers are abandoned then, so that this is only checked until all of
+  // them are ready.
+  for (int pid : mPids) {
+    int status = 0;
+
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+      if (!mFailed.exchange(true)) {
+        logger().warn("Ephemeris worker {} exited with code {} before it was ready! Ephemerides "
+                      "are evaluated locally.",
+            pid, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+      }
+      return false;
+    }
+  }
+
+  return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool EphemerisWorkers::isOutdated() const {
+#ifndef CSP_TRAJECTORIES_WORKERS_SUPPORTED
+  return false;
+#else
+  return mShared && getLoadedKernelCount() != mKernelCount;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool EphemerisWorkers::evaluate(int targetId, int observerId, std::string const& frame,
+    double const* times, size_t count, glm::dvec3* positions, glm::dvec3* velocities) {
+
+#ifndef CSP_TRAJECTORIES_WORKERS_SUPPORTED
+  return false;
+#else
+  if (!isAvailable() || frame.size() >= protocol::FRAME_NAME_LENGTH) {
+    return false;
+  }
+
+  // The batch is split evenly over all workers. Each chunk is one batch of the ring.
+  size_t chunkSize = (count + mWorkerCount - 1) / mWorkerCount;
+  chunkSize        = std::clamp(chunkSize, MIN_CHUNK_SIZE, protocol::BATCH_CAPACITY);
+
+  struct Chunk {
+    protocol::SharedBatch* mBatch;
+    size_t                 mOffset;
+  };
+
+  // The chunks in flight are kept in a small ring on the stack. This is called by several threads
+  // at once, so it cannot be a member, but it must not allocate either.
+  std::array<Chunk, MAX_CHUNKS_IN_FLIGHT> chunks{};
+  size_t                                  firstChunk = 0;
+  size_t                                  chunkCount = 0;
+
+  size_t maxChunks = std::min(mWorkerCount, MAX_CHUNKS_IN_FLIGHT);
+  size_t offset    = 0;
+
+  while (offset < count || chunkCount > 0) {
+
+    // Submit new chunks as long as there are free batches. If there are none, the results of the
+    // oldest chunk are collected first, so that its batch can be reused.
+    if (offset < count && chunkCount < maxChunks) {
+      if (auto* batch = acquireBatch(*mShared)) {
+        size_t size = std::min(chunkSize, count - offset);
+
+        batch->mTargetId       = targetId;
+        batch->mObserverId     = observerId;
+        batch->mCount          = static_cast<uint32_t>(size);
+        batch->mWithVelocities = velocities != nullptr;
+        std::copy(frame.begin(), frame.end(), batch->mFrame.begin());
+        batch->mFrame[frame.size()] = '\0';
+        std::copy(times + offset, times + offset + size, batch->mTimes.begin());
+
+        batch->mState = protocol::BatchState::eRequested;
+        sem_post(&mShared->mWork);
+
+        chunks.at((firstChunk + chunkCount) % MAX_CHUNKS_IN_FLIGHT) = {batch, offset};
+        ++chunkCount;
+        offset += size;
+        continue;
+      }
+
+      // All batches are used by other threads.
+      if (chunkCount == 0) {
+        return false;
+      }
+    }
+
+    Chunk chunk = chunks.at(firstChunk);
+    firstChunk  = (firstChunk + 1) % MAX_CHUNKS_IN_FLIGHT;
+    --chunkCount;
+
+    // If a worker does not answer or has exited, its batch cannot be reused, as the worker may
+    // still write to it. All workers are abandoned then.
+    if (!waitFor(&chunk.mBatch->mDone, mPids)) {
+      if (!mFailed.exchange(true)) {
+        logger().warn("Ephemeris workers stopped responding or exited! Ephemerides are evaluated "
+                      "locally.");
+      }
+      return false;
+    }
+
+    auto const& states = chunk.mBatch->mStates;
+
+    for (size_t i = 0; i < chunk.mBatch->mCount; ++i) {
+      positions[chunk.mOffset + i] =
+          glm::dvec3(states[i * 6], states[i * 6 + 1], states[i * 6 + 2]);
+
+      if (velocities) {
+        velocities[chunk.mOffset + i] =
+            glm::dvec3(states[i * 6 + 3], states[i * 6 + 4], states[i * 6 + 5]);
+      }
+    }
+
+    chunk.mBatch->mState = protocol::BatchState::eFree;
+  }
+
+  return true;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_EPHEMERIS_WORKERS_HPP
+#define CSP_TRAJECTORIES_EPHEMERIS_WORKERS_HPP
+
+#include <atomic>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace csp::trajectories {
+
+namespace protocol {
+struct SharedState;
+} // namespace protocol
+
+/// The SPICE toolkit is not thread-safe, so only one thread of a process can evaluate ephemerides
+/// at a time. The EphemerisWorkers start a number of csp-trajectories-ephemeris-worker processes
+/// which load the same kernels as CosmoScout VR. Large batches of sample times are split into
+/// chunks which are evaluated by all workers in parallel. Requests and results are exchanged
+/// through a ring of batches in shared memory, see EphemerisWorkerProtocol.hpp.
+///
+/// The worker executable is expected next to the CosmoScout VR executable. Worker processes are
+/// only supported on POSIX systems other than macOS. If the workers cannot be started or stop
+/// responding, they are not used anymore and the Ephemeris evaluates everything itself.
+class EphemerisWorkers {
+ public:
+  explicit EphemerisWorkers(size_t workerCount);
+
+  EphemerisWorkers(EphemerisWorkers const& other) = delete;
+  EphemerisWorkers(EphemerisWorkers&& other)      = delete;
+
+  EphemerisWorkers& operator=(EphemerisWorkers const& other) = delete;
+  EphemerisWorkers& operator=(EphemerisWorkers&& other) = delete;
+
+  /// Stops all worker processes.
+  ~EphemerisWorkers();
+
+  size_t getWorkerCount() const;
+
+  /// Returns true once all workers have loaded their kernels and as long as none of them failed.
+  /// If a worker exits before it is ready, a warning is printed and the workers are not used
+  /// anymore.
+  bool isAvailable();
+
+  /// The workers only load the kernels which were loaded when they were started. This returns
+  /// true if kernels have been loaded or unloaded since then. The workers have to be restarted in
+  /// this case.
+  bool isOutdated() const;
+
+  /// Evaluates the position and, if velocities is not a nullptr, the velocity of the target
+  /// relative to the observer in the given frame at count times. The results are in kilometers
+  /// and kilometers per second. If there is no data for a time, its results are set to NaN.
+  /// This can be called from multiple threads. If false is returned, the batch could not be
+  /// evaluated by the workers and has to be evaluated by the caller.
+  bool evaluate(int targetId, int observerId, std::string const& frame, double const* times,
+      size_t count, glm::dvec3* positions, glm::dvec3* velocities);
+
+ private:
+  size_t                 mWorkerCount;
+  std::string            mSharedName;
+  size_t                 mSharedSize  = 0;
+  size_t                 mKernelCount = 0;
+  protocol::SharedState* mShared      = nullptr;
+  std::vector<int>       mPids;
+  std::atomic<bool>      mFailed{false};
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_EPHEMERIS_WORKERS_HPP
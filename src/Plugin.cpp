@@ -6,15 +6,29 @@
 
 #include "Plugin.hpp"
 
+#include "ClusterSync.hpp"
+#include "ConjunctionSearch.hpp"
 #include "DeepSpaceDot.hpp"
+#include "DeepSpaceDotClusters.hpp"
+#include "Ephemeris.hpp"
+#include "EphemerisWorkers.hpp"
+#include "SessionRecorder.hpp"
+#include "SessionReplay.hpp"
 #include "SunFlare.hpp"
+#include "ThreadPool.hpp"
+#include "TrailCache.hpp"
 #include "Trajectory.hpp"
 #include "logger.hpp"
 
 #include "../../../src/cs-core/GuiManager.hpp"
 #include "../../../src/cs-core/SolarSystem.hpp"
+#include "../../../src/cs-core/TimeControl.hpp"
+#include "../../../src/cs-utils/FrameTimings.hpp"
 #include "../../../src/cs-utils/logger.hpp"
 
+#include <algorithm>
+#include <cstdlib>
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 EXPORT_FN cs::core::PluginBase* create() {
@@ -33,16 +47,29 @@ namespace csp::trajectories {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+// The names of the frame timers. They are created once, so that starting a timer in each frame
+// does not allocate memory.
+const std::string CONJUNCTION_TIMER_NAME = "Conjunction Search";
+const std::string SAMPLING_TIMER_NAME    = "Trajectory Sampling";
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void from_json(nlohmann::json const& j, Plugin::Settings::Trajectory::Trail& o) {
   cs::core::Settings::deserialize(j, "length", o.mLength);
   cs::core::Settings::deserialize(j, "samples", o.mSamples);
   cs::core::Settings::deserialize(j, "parent", o.mParent);
+  cs::core::Settings::deserialize(j, "period", o.mPeriod);
 }
 
 void to_json(nlohmann::json& j, Plugin::Settings::Trajectory::Trail const& o) {
   cs::core::Settings::serialize(j, "length", o.mLength);
   cs::core::Settings::serialize(j, "samples", o.mSamples);
   cs::core::Settings::serialize(j, "parent", o.mParent);
+  cs::core::Settings::serialize(j, "period", o.mPeriod);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -68,6 +95,31 @@ void from_json(nlohmann::json const& j, Plugin::Settings& o) {
   cs::core::Settings::deserialize(j, "enableTrajectories", o.mEnableTrajectories);
   cs::core::Settings::deserialize(j, "enableSunFlares", o.mEnableSunFlares);
   cs::core::Settings::deserialize(j, "enablePlanetMarks", o.mEnablePlanetMarks);
+  cs::core::Settings::deserialize(j, "warmUpSamples", o.mWarmUpSamples);
+  cs::core::Settings::deserialize(j, "warmUpDuration", o.mWarmUpDuration);
+  cs::core::Settings::deserialize(j, "enableContinuousUpdates", o.mEnableContinuousUpdates);
+  cs::core::Settings::deserialize(j, "maxSamplesPerFrame", o.mMaxSamplesPerFrame);
+  cs::core::Settings::deserialize(j, "enableHermiteTrails", o.mEnableHermiteTrails);
+  cs::core::Settings::deserialize(j, "hermiteSegmentPixels", o.mHermiteSegmentPixels);
+  cs::core::Settings::deserialize(j, "alignSamplesToTimeGrid", o.mAlignSamplesToTimeGrid);
+  cs::core::Settings::deserialize(j, "trailDetailLevels", o.mTrailDetailLevels);
+  cs::core::Settings::deserialize(j, "enableResidentTrails", o.mEnableResidentTrails);
+  cs::core::Settings::deserialize(j, "updatePixelThreshold", o.mUpdatePixelThreshold);
+  cs::core::Settings::deserialize(j, "periodicDriftTolerance", o.mPeriodicDriftTolerance);
+  cs::core::Settings::deserialize(j, "cacheDirectory", o.mCacheDirectory);
+  cs::core::Settings::deserialize(j, "cacheSizeLimit", o.mCacheSizeLimit);
+  cs::core::Settings::deserialize(j, "trailMemoryBudget", o.mTrailMemoryBudget);
+  cs::core::Settings::deserialize(j, "samplingThreads", o.mSamplingThreads);
+  cs::core::Settings::deserialize(j, "ephemerisWorkers", o.mEphemerisWorkers);
+  cs::core::Settings::deserialize(j, "conjunctionDistance", o.mConjunctionDistance);
+  cs::core::Settings::deserialize(j, "conjunctionBucketDuration", o.mConjunctionBucketDuration);
+  cs::core::Settings::deserialize(j, "enableClusterSync", o.mEnableClusterSync);
+  cs::core::Settings::deserialize(j, "enablePlanetMarkClustering", o.mEnablePlanetMarkClustering);
+  cs::core::Settings::deserialize(j, "planetMarkClusterPixels", o.mPlanetMarkClusterPixels);
+  cs::core::Settings::deserialize(j, "enableFastSunFlares", o.mEnableFastSunFlares);
+  cs::core::Settings::deserialize(j, "recordFile", o.mRecordFile);
+  cs::core::Settings::deserialize(j, "replayFile", o.mReplayFile);
+  cs::core::Settings::deserialize(j, "exitAfterReplay", o.mExitAfterReplay);
 }
 
 void to_json(nlohmann::json& j, Plugin::Settings const& o) {
@@ -75,6 +127,31 @@ void to_json(nlohmann::json& j, Plugin::Settings const& o) {
   cs::core::Settings::serialize(j, "enableTrajectories", o.mEnableTrajectories);
   cs::core::Settings::serialize(j, "enableSunFlares", o.mEnableSunFlares);
   cs::core::Settings::serialize(j, "enablePlanetMarks", o.mEnablePlanetMarks);
+  cs::core::Settings::serialize(j, "warmUpSamples", o.mWarmUpSamples);
+  cs::core::Settings::serialize(j, "warmUpDuration", o.mWarmUpDuration);
+  cs::core::Settings::serialize(j, "enableContinuousUpdates", o.mEnableContinuousUpdates);
+  cs::core::Settings::serialize(j, "maxSamplesPerFrame", o.mMaxSamplesPerFrame);
+  cs::core::Settings::serialize(j, "enableHermiteTrails", o.mEnableHermiteTrails);
+  cs::core::Settings::serialize(j, "hermiteSegmentPixels", o.mHermiteSegmentPixels);
+  cs::core::Settings::serialize(j, "alignSamplesToTimeGrid", o.mAlignSamplesToTimeGrid);
+  cs::core::Settings::serialize(j, "trailDetailLevels", o.mTrailDetailLevels);
+  cs::core::Settings::serialize(j, "enableResidentTrails", o.mEnableResidentTrails);
+  cs::core::Settings::serialize(j, "updatePixelThreshold", o.mUpdatePixelThreshold);
+  cs::core::Settings::serialize(j, "periodicDriftTolerance", o.mPeriodicDriftTolerance);
+  cs::core::Settings::serialize(j, "cacheDirectory", o.mCacheDirectory);
+  cs::core::Settings::serialize(j, "cacheSizeLimit", o.mCacheSizeLimit);
+  cs::core::Settings::serialize(j, "trailMemoryBudget", o.mTrailMemoryBudget);
+  cs::core::Settings::serialize(j, "samplingThreads", o.mSamplingThreads);
+  cs::core::Settings::serialize(j, "ephemerisWorkers", o.mEphemerisWorkers);
+  cs::core::Settings::serialize(j, "conjunctionDistance", o.mConjunctionDistance);
+  cs::core::Settings::serialize(j, "conjunctionBucketDuration", o.mConjunctionBucketDuration);
+  cs::core::Settings::serialize(j, "enableClusterSync", o.mEnableClusterSync);
+  cs::core::Settings::serialize(j, "enablePlanetMarkClustering", o.mEnablePlanetMarkClustering);
+  cs::core::Settings::serialize(j, "planetMarkClusterPixels", o.mPlanetMarkClusterPixels);
+  cs::core::Settings::serialize(j, "enableFastSunFlares", o.mEnableFastSunFlares);
+  cs::core::Settings::serialize(j, "recordFile", o.mRecordFile);
+  cs::core::Settings::serialize(j, "replayFile", o.mReplayFile);
+  cs::core::Settings::serialize(j, "exitAfterReplay", o.mExitAfterReplay);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -111,6 +188,30 @@ void Plugin::init() {
     mGuiManager->setCheckboxValue("trajectories.setEnableSunFlare", enable);
   });
 
+  mGuiManager->getGui()->registerCallback("trajectories.setTrajectory",
+      "Adds or reconfigures the trajectory, planet mark and sun flare of the given anchor. The "
+      "second parameter contains the settings in the same JSON format as in the settings file.",
+      std::function([this](std::string&& name, std::string&& json) {
+        try {
+          setTrajectory(name, nlohmann::json::parse(json).get<Settings::Trajectory>());
+        } catch (std::exception const& e) {
+          logger().warn("Failed to set trajectory for '{}': {}", name, e.what());
+        }
+      }));
+
+  mGuiManager->getGui()->registerCallback("trajectories.removeTrajectory",
+      "Removes the trajectory, planet mark and sun flare of the given anchor.",
+      std::function([this](std::string&& name) { removeTrajectory(name); }));
+
+  mGuiManager->getGui()->registerCallback("trajectories.setTrailParent",
+      "Draws the trail of the anchor given by the first parameter relative to the anchor given by "
+      "the second parameter.",
+      std::function([this](std::string&& name, std::string&& parent) {
+        setTrailParent(name, parent);
+      }));
+
+  mDeepSpaceDotClusters = std::make_unique<DeepSpaceDotClusters>(mPluginSettings);
+
   // Load settings.
   onLoad();
 
@@ -122,11 +223,21 @@ void Plugin::init() {
 void Plugin::deInit() {
   logger().info("Unloading plugin...");
 
+  mClusterSync.reset();
+  mRecorder.reset();
+  mReplay.reset();
+  mThreadPool.reset();
+  mConjunctionSearch.reset();
+
+  Ephemeris::setWorkers(nullptr);
+  mEphemerisWorkers.reset();
+
   for (auto const& flare : mSunFlares) {
     mSolarSystem->unregisterAnchor(flare.second);
   }
 
   for (auto const& trajectory : mTrajectories) {
+    trajectory.second->saveToCache();
     mSolarSystem->unregisterAnchor(trajectory.second);
   }
 
@@ -134,11 +245,16 @@ void Plugin::deInit() {
     mSolarSystem->unregisterAnchor(dot.second);
   }
 
+  mDeepSpaceDotClusters.reset();
+
   mGuiManager->removeSettingsSection("Trajectories");
 
   mGuiManager->getGui()->unregisterCallback("trajectories.setEnableTrajectories");
   mGuiManager->getGui()->unregisterCallback("trajectories.setEnablePlanetMarks");
   mGuiManager->getGui()->unregisterCallback("trajectories.setEnableSunFlare");
+  mGuiManager->getGui()->unregisterCallback("trajectories.setTrajectory");
+  mGuiManager->getGui()->unregisterCallback("trajectories.removeTrajectory");
+  mGuiManager->getGui()->unregisterCallback("trajectories.setTrailParent");
 
   mAllSettings->onLoad().disconnect(mOnLoadConnection);
   mAllSettings->onSave().disconnect(mOnSaveConnection);
@@ -148,153 +264,560 @@ void Plugin::deInit() {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+void Plugin::update() {
+
+  // The data sync has to be used by all nodes in the same order, so it is created and destroyed
+  // here, where all nodes see the same value of the setting.
+  if (mPluginSettings->mEnableClusterSync.get() != static_cast<bool>(mClusterSync)) {
+    if (mClusterSync) {
+      mClusterSync.reset();
+    } else {
+      mClusterSync = std::make_unique<ClusterSync>();
+    }
+  }
+
+  // Kernels which have been loaded after the worker processes were started, for example by other
+  // plugins, are not known to them. Hence the workers are restarted with all current kernels.
+  if (mEphemerisWorkers && mEphemerisWorkers->isOutdated()) {
+    logger().info("SPICE kernels changed, restarting the ephemeris workers.");
+
+    size_t workerCount = mEphemerisWorkers->getWorkerCount();
+    Ephemeris::setWorkers(nullptr);
+    mEphemerisWorkers.reset();
+    mEphemerisWorkers = std::make_shared<EphemerisWorkers>(workerCount);
+    Ephemeris::setWorkers(mEphemerisWorkers);
+  }
+
+  // With cluster sync, the trails are sampled by the ClusterSync on the leader node only.
+  int32_t threadCount = mClusterSync ? 0 : mPluginSettings->mSamplingThreads.get();
+  updateSamplesInParallel(mTimeControl->pSimulationTime.get(),
+      static_cast<size_t>(std::max(threadCount, 0)));
+
+  // Plugins are updated before the SolarSystem, so the new samples are available when the
+  // trajectories are updated.
+  if (mClusterSync) {
+    mClusterSync->update(mTimeControl->pSimulationTime.get(), mTrajectories);
+  }
+
+  // With cluster sync, the followers only receive changed samples, so they must not evict samples
+  // independently. They evict the trails which were evicted by the leader instead.
+  bool isFollower = mClusterSync && !mClusterSync->getIsLeader();
+  if (!isFollower && mPluginSettings->mTrailMemoryBudget.get() > 0.0) {
+    enforceMemoryBudget(
+        static_cast<size_t>(mPluginSettings->mTrailMemoryBudget.get() * 1024.0 * 1024.0));
+  }
+
+  // The samples of the last frame are searched, as the trajectories are updated after the plugin.
+  if (mPluginSettings->mConjunctionDistance.get() > 0.0) {
+    cs::utils::FrameTimings::ScopedTimer timer(CONJUNCTION_TIMER_NAME);
+
+    if (!mConjunctionSearch) {
+      mConjunctionSearch = std::make_unique<ConjunctionSearch>();
+    }
+
+    mConjunctionSearch->setDistance(mPluginSettings->mConjunctionDistance.get() * 1000.0);
+    mConjunctionSearch->setBucketDuration(
+        mPluginSettings->mConjunctionBucketDuration.get() * 60.0 * 60.0);
+
+    if (mConjunctionSearch->update(mTrajectories)) {
+      logger().debug(
+          "Found {} close approaches of trails.", mConjunctionSearch->getConjunctions().size());
+    }
+  } else {
+    mConjunctionSearch.reset();
+  }
+
+  if (mRecorder) {
+    mRecorder->recordFrame(mTimeControl->pSimulationTime.get(), mSolarSystem->getObserver());
+  }
+
+  // The replay is started in the first frame after it has been requested. The recorded settings
+  // are applied during the replay, the current settings are restored afterwards.
+  if (mReplay) {
+    auto           replay   = std::move(mReplay);
+    nlohmann::json settings = mAllSettings->mPlugins.at("csp-trajectories");
+
+    // The replay calls update() of the trajectories directly, so they have to sample themselves.
+    updateSamplesInParallel(0.0, 0);
+
+    mIsReplaying = true;
+
+    bool passed = replay->run(
+        [this](nlohmann::json const& recordedSettings) {
+          mAllSettings->mPlugins["csp-trajectories"] = recordedSettings;
+          onLoad();
+        },
+        mTrajectories, mDeepSpaceDots, mSunFlares);
+
+    mAllSettings->mPlugins["csp-trajectories"] = settings;
+    onLoad();
+
+    mIsReplaying = false;
+
+    // This allows scripts to run a replay and check its result, for example in a CI pipeline. The
+    // application cannot return an exit code, so the process is terminated here. std::exit() does
+    // not destroy the plugin, hence it is unloaded first. Else the worker processes and their
+    // shared memory would outlive the process.
+    if (mPluginSettings->mExitAfterReplay.get()) {
+      logger().info("Quitting after the replay of '{}'.", mLastReplayFile);
+      deInit();
+      std::exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Plugin::enforceMemoryBudget(size_t budget) {
+  size_t usage = 0;
+  for (auto const& trajectory : mTrajectories) {
+    usage += trajectory.second->getMemoryUsage();
+  }
+
+  if (usage <= budget) {
+    return;
+  }
+
+  // Only trajectories which are not drawn currently are evicted, the least recently drawn first.
+  mEvictionCandidates.clear();
+  for (auto const& trajectory : mTrajectories) {
+    if (trajectory.second->canBeEvicted()) {
+      mEvictionCandidates.push_back(trajectory.second.get());
+    }
+  }
+
+  std::sort(mEvictionCandidates.begin(), mEvictionCandidates.end(),
+      [](Trajectory* a, Trajectory* b) {
+        return a->getLastVisibleTime() < b->getLastVisibleTime();
+      });
+
+  for (auto* trajectory : mEvictionCandidates) {
+    if (usage <= budget) {
+      break;
+    }
+
+    size_t before = trajectory->getMemoryUsage();
+    trajectory->evict();
+    usage -= std::min(usage, before - trajectory->getMemoryUsage());
+
+    logger().debug("Evicted samples of trajectory for {} to stay within the memory budget.",
+        trajectory->getTargetCenterName());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<Plugin::TrailPoint> Plugin::pickTrail(
+    glm::dvec3 const& rayOrigin, glm::dvec3 const& rayDirection, double maxAngle) const {
+
+  std::optional<TrailPoint> result;
+
+  for (auto const& [name, trajectory] : mTrajectories) {
+    auto pick = trajectory->intersect(rayOrigin, rayDirection, maxAngle);
+
+    // Later trajectories only have to beat the best angle so far.
+    if (pick) {
+      maxAngle = pick->mError;
+      result   = TrailPoint{name, pick->mTime, pick->mPosition};
+    }
+  }
+
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<Plugin::TrailPoint> Plugin::getNearestTrailPoint(
+    glm::dvec3 const& position, double maxDistance) const {
+
+  std::optional<TrailPoint> result;
+
+  for (auto const& [name, trajectory] : mTrajectories) {
+    auto pick = trajectory->getNearestPoint(position, maxDistance);
+
+    if (pick) {
+      maxDistance = pick->mError;
+      result      = TrailPoint{name, pick->mTime, pick->mPosition};
+    }
+  }
+
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<Plugin::TrailView> Plugin::getTrailView(std::string const& name) const {
+  auto trajectory = mTrajectories.find(name);
+
+  if (trajectory == mTrajectories.end()) {
+    return std::nullopt;
+  }
+
+  return trajectory->second->getView();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<uint64_t> Plugin::getTrailGeneration(std::string const& name) const {
+  auto trajectory = mTrajectories.find(name);
+
+  if (trajectory == mTrajectories.end()) {
+    return std::nullopt;
+  }
+
+  return trajectory->second->getGeneration();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Plugin::isTrailViewValid(std::string const& name, TrailView const& view) const {
+  return getTrailGeneration(name) == view.mGeneration;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::vector<Plugin::Conjunction> const& Plugin::getConjunctions() const {
+  static const std::vector<Conjunction> empty;
+  return mConjunctionSearch ? mConjunctionSearch->getConjunctions() : empty;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void Plugin::onLoad() {
 
   // Read settings from JSON.
   from_json(mAllSettings->mPlugins.at("csp-trajectories"), *mPluginSettings);
 
-  // We just recreate all SunFlares and DeepSpaceDots as they are quite cheap to construct. So
-  // delete all existing ones first.
-  for (auto const& flare : mSunFlares) {
-    mSolarSystem->unregisterAnchor(flare.second);
+  // Create a new trail cache if the cache directory or its size limit changed.
+  double cacheSizeLimitMiB = std::max(0.0, mPluginSettings->mCacheSizeLimit.get());
+  auto   cacheSizeLimit    = static_cast<uint64_t>(cacheSizeLimitMiB * 1024.0 * 1024.0);
+
+  if (!mPluginSettings->mCacheDirectory) {
+    mTrailCache.reset();
+  } else if (!mTrailCache || mTrailCache->getDirectory() != *mPluginSettings->mCacheDirectory ||
+             mTrailCache->getSizeLimit() != cacheSizeLimit) {
+    mTrailCache =
+        std::make_shared<TrailCache>(*mPluginSettings->mCacheDirectory, cacheSizeLimit);
   }
-  for (auto const& dot : mDeepSpaceDots) {
-    mSolarSystem->unregisterAnchor(dot.second);
+
+  // SPICE can only be used by one thread of a process at a time, so parallel sampling only scales
+  // if the ephemerides are evaluated by worker processes. If their number is not given, one is
+  // started for each sampling thread, including the main thread. The worker processes are only
+  // restarted if their number changed.
+  auto workerCount = static_cast<size_t>(std::max(mPluginSettings->mEphemerisWorkers.get(), 0));
+
+  if (workerCount == 0 && mPluginSettings->mSamplingThreads.get() > 0) {
+    workerCount = static_cast<size_t>(mPluginSettings->mSamplingThreads.get()) + 1;
   }
-  mSunFlares.clear();
-  mDeepSpaceDots.clear();
 
-  // Now we go through all configured trajectories and create all required SunFlares and
-  // DeepSpaceDots.
-  for (auto const& settings : mPluginSettings->mTrajectories) {
-    auto anchor = mAllSettings->mAnchors.find(settings.first);
+  if (workerCount != (mEphemerisWorkers ? mEphemerisWorkers->getWorkerCount() : 0)) {
+    Ephemeris::setWorkers(nullptr);
+    mEphemerisWorkers.reset();
 
-    if (anchor == mAllSettings->mAnchors.end()) {
-      logger().warn("Cannot add sun flare or planet mark for '{}': There is no such anchor defined "
-                    "in the settings!",
-          settings.first);
-      continue;
+    if (workerCount > 0) {
+      mEphemerisWorkers = std::make_shared<EphemerisWorkers>(workerCount);
+      Ephemeris::setWorkers(mEphemerisWorkers);
     }
+  }
 
-    auto [tStartExistence, tEndExistence] = anchor->second.getExistence();
+  // The settings which are applied during a replay must not start or stop a recording or another
+  // replay.
+  if (!mIsReplaying) {
+    if (!mPluginSettings->mRecordFile) {
+      mRecorder.reset();
+    } else if (!mRecorder || mRecorder->getFileName() != *mPluginSettings->mRecordFile) {
+      mRecorder = std::make_unique<SessionRecorder>(*mPluginSettings->mRecordFile);
+    }
 
-    // Add the SunFlare.
-    if (settings.second.mDrawFlare.value_or(false)) {
-      auto flare = std::make_shared<SunFlare>(mAllSettings, mPluginSettings, anchor->second.mCenter,
-          anchor->second.mFrame, tStartExistence, tEndExistence);
-      mSolarSystem->registerAnchor(flare);
+    if (mRecorder) {
+      mRecorder->recordSettings(mAllSettings->mPlugins.at("csp-trajectories"));
+    }
 
-      flare->pColor =
-          VistaColor(settings.second.mColor.r, settings.second.mColor.g, settings.second.mColor.b);
+    if (mPluginSettings->mReplayFile.value_or("") != mLastReplayFile) {
+      mLastReplayFile = mPluginSettings->mReplayFile.value_or("");
 
-      mSunFlares[settings.first] = flare;
+      if (!mLastReplayFile.empty()) {
+        mReplay = std::make_unique<SessionReplay>(mLastReplayFile);
+      }
     }
+  }
 
-    // Add the DeepSpaceDot.
-    if (settings.second.mDrawDot.value_or(false)) {
-      auto dot = std::make_shared<DeepSpaceDot>(mPluginSettings, anchor->second.mCenter,
-          anchor->second.mFrame, tStartExistence, tEndExistence);
-      mSolarSystem->registerAnchor(dot);
-
-      dot->pColor =
-          VistaColor(settings.second.mColor.r, settings.second.mColor.g, settings.second.mColor.b);
+  // Remove all objects whose anchor is not configured anymore. All others are created or
+  // reconfigured in place, which does nothing for objects whose settings did not change.
+  std::vector<std::string> removed;
 
-      // do not perform distance culling for DeepSpaceDots
-      dot->pVisibleRadius = -1;
-      dot->pVisible       = true;
+  for (auto const& trajectory : mTrajectories) {
+    if (mPluginSettings->mTrajectories.find(trajectory.first) ==
+        mPluginSettings->mTrajectories.end()) {
+      removed.push_back(trajectory.first);
+    }
+  }
 
-      mDeepSpaceDots[settings.first] = dot;
+  for (auto const& dot : mDeepSpaceDots) {
+    if (mPluginSettings->mTrajectories.find(dot.first) == mPluginSettings->mTrajectories.end()) {
+      removed.push_back(dot.first);
     }
   }
 
-  // For the trajectories we try to re-use as many as possible as they are quite expensive to
-  // construct. First try to re-configure existing trajectories. A trajectory is re-used if it
-  // shares the same target anchor name.
-  for (auto trajectory = mTrajectories.begin(); trajectory != mTrajectories.end();) {
-    auto settings = mPluginSettings->mTrajectories.find(trajectory->first);
-
-    // If there are settings for this trajectory, reconfigure it.
-    if (settings != mPluginSettings->mTrajectories.end() && settings->second.mTrail) {
-      auto parentAnchor = mAllSettings->mAnchors.find(settings->second.mTrail->mParent);
-      auto targetAnchor = mAllSettings->mAnchors.find(settings->first);
-
-      // Ignore wrongly configured trajectories for now. The error will be emitted when we try to
-      // add this as a new trajectory.
-      if (parentAnchor != mAllSettings->mAnchors.end() &&
-          targetAnchor != mAllSettings->mAnchors.end()) {
-
-        auto [parentStartExistence, parentEndExistence] = parentAnchor->second.getExistence();
-        auto [targetStartExistence, targetEndExistence] = targetAnchor->second.getExistence();
-        trajectory->second->setStartExistence(std::max(parentStartExistence, targetStartExistence));
-        trajectory->second->setEndExistence(std::min(parentEndExistence, targetEndExistence));
-        trajectory->second->setCenterName(parentAnchor->second.mCenter);
-        trajectory->second->setFrameName(parentAnchor->second.mFrame);
-        trajectory->second->setTargetCenterName(targetAnchor->second.mCenter);
-        trajectory->second->setTargetFrameName(targetAnchor->second.mFrame);
-        trajectory->second->pSamples = settings->second.mTrail->mSamples;
-        trajectory->second->pLength  = settings->second.mTrail->mLength;
-        trajectory->second->pColor   = settings->second.mColor;
-
-        ++trajectory;
-
-        continue;
-      }
+  for (auto const& flare : mSunFlares) {
+    if (mPluginSettings->mTrajectories.find(flare.first) == mPluginSettings->mTrajectories.end()) {
+      removed.push_back(flare.first);
     }
+  }
+
+  // An anchor may be listed up to three times, once for each kind of object.
+  std::sort(removed.begin(), removed.end());
+  removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
 
-    // Else delete it.
-    mSolarSystem->unregisterAnchor(trajectory->second);
-    trajectory = mTrajectories.erase(trajectory);
+  for (auto const& name : removed) {
+    applySettings(name, nullptr);
   }
 
-  // Then create all new trajectories.
   for (auto const& settings : mPluginSettings->mTrajectories) {
-    if (settings.second.mTrail) {
-      if (mTrajectories.find(settings.first) != mTrajectories.end()) {
-        continue;
-      }
+    applySettings(settings.first, &settings.second);
+  }
+}
 
-      auto parentAnchor = mAllSettings->mAnchors.find(settings.second.mTrail->mParent);
-      auto targetAnchor = mAllSettings->mAnchors.find(settings.first);
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-      if (parentAnchor == mAllSettings->mAnchors.end()) {
-        logger().warn("Cannot add trajectory for '{}': There is no parent anchor '{}' defined in "
-                      "the settings!",
-            settings.first, settings.second.mTrail->mParent);
-        continue;
-      }
+void Plugin::setTrajectory(std::string const& name, Settings::Trajectory const& settings) {
+  auto& stored = mPluginSettings->mTrajectories[name];
+  stored       = settings;
+  applySettings(name, &stored);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Plugin::removeTrajectory(std::string const& name) {
+  mPluginSettings->mTrajectories.erase(name);
+  applySettings(name, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-      if (targetAnchor == mAllSettings->mAnchors.end()) {
-        logger().warn(
-            "Cannot add trajectory for '{}': There is no such anchor defined in the settings!",
-            settings.first);
-        continue;
+void Plugin::setTrailParent(std::string const& name, std::string const& parent) {
+  auto settings = mPluginSettings->mTrajectories.find(name);
+
+  if (settings == mPluginSettings->mTrajectories.end() || !settings->second.mTrail) {
+    logger().warn("Cannot change the parent of the trail for '{}': There is no such trail!", name);
+    return;
+  }
+
+  settings->second.mTrail->mParent = parent;
+  applyTrajectorySettings(name, &settings->second);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Plugin::updateSamplesInParallel(double tTime, size_t threadCount) {
+  if (threadCount == 0) {
+    if (mThreadPool) {
+      mThreadPool.reset();
+
+      for (auto const& trajectory : mTrajectories) {
+        trajectory.second->setExternalSampling(false);
       }
+    }
 
-      auto [parentStartExistence, parentEndExistence] = parentAnchor->second.getExistence();
-      auto [targetStartExistence, targetEndExistence] = targetAnchor->second.getExistence();
+    return;
+  }
 
-      auto trajectory = std::make_shared<Trajectory>(mPluginSettings, targetAnchor->second.mCenter,
-          targetAnchor->second.mFrame, parentAnchor->second.mCenter, parentAnchor->second.mFrame,
-          std::max(parentStartExistence, targetStartExistence),
-          std::min(parentEndExistence, targetEndExistence));
+  if (!mThreadPool || mThreadPool->getThreadCount() != threadCount) {
+    mThreadPool = std::make_unique<ThreadPool>(threadCount);
+    logger().info("Sampling trails on {} additional threads.", threadCount);
+  }
 
-      trajectory->pSamples = settings.second.mTrail->mSamples;
-      trajectory->pLength  = settings.second.mTrail->mLength;
-      trajectory->pColor   = settings.second.mColor;
+  cs::utils::FrameTimings::ScopedTimer timer(SAMPLING_TIMER_NAME);
 
-      // Change visibility of dots together with trajectory.
-      trajectory->pVisible.connectAndTouch([this, anchorName = settings.first](bool visible) {
-        auto dot = mDeepSpaceDots.find(anchorName);
-        if (dot != mDeepSpaceDots.end()) {
-          dot->second->pVisible = visible;
-        }
-      });
+  // Each trajectory is one task. Trails which do not need new samples in this frame are not
+  // scheduled at all.
+  mSamplingTasks.clear();
 
-      mSolarSystem->registerAnchor(trajectory);
+  for (auto const& trajectory : mTrajectories) {
+    trajectory.second->setExternalSampling(true);
 
-      mTrajectories.emplace(settings.first, trajectory);
+    if (trajectory.second->needsSampling(tTime)) {
+      mSamplingTasks.emplace_back(
+          [trajectory = trajectory.second.get(), tTime]() { trajectory->updateSamples(tTime); });
     }
   }
+
+  mThreadPool->run(mSamplingTasks);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Plugin::applySettings(std::string const& name, Settings::Trajectory const* settings) {
+  applySunFlareSettings(name, settings);
+  applyTrajectorySettings(name, settings);
+  applyDeepSpaceDotSettings(name, settings);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Plugin::applySunFlareSettings(std::string const& name, Settings::Trajectory const* settings) {
+  auto flare  = mSunFlares.find(name);
+  auto anchor = mAllSettings->mAnchors.find(name);
+
+  if (settings && settings->mDrawFlare.value_or(false) && anchor == mAllSettings->mAnchors.end()) {
+    logger().warn(
+        "Cannot add sun flare for '{}': There is no such anchor defined in the settings!", name);
+  }
+
+  // Remove the SunFlare if it is not required anymore.
+  if (!settings || !settings->mDrawFlare.value_or(false) ||
+      anchor == mAllSettings->mAnchors.end()) {
+    if (flare != mSunFlares.end()) {
+      mSolarSystem->unregisterAnchor(flare->second);
+      mSunFlares.erase(flare);
+    }
+    return;
+  }
+
+  auto [tStartExistence, tEndExistence] = anchor->second.getExistence();
+
+  // Add the SunFlare or reconfigure the existing one.
+  if (flare == mSunFlares.end()) {
+    auto newFlare = std::make_shared<SunFlare>(mAllSettings, mPluginSettings,
+        anchor->second.mCenter, anchor->second.mFrame, tStartExistence, tEndExistence);
+    mSolarSystem->registerAnchor(newFlare);
+    flare = mSunFlares.emplace(name, newFlare).first;
+  } else {
+    flare->second->setCenterName(anchor->second.mCenter);
+    flare->second->setFrameName(anchor->second.mFrame);
+    flare->second->setStartExistence(tStartExistence);
+    flare->second->setEndExistence(tEndExistence);
+  }
+
+  flare->second->pColor = VistaColor(settings->mColor.r, settings->mColor.g, settings->mColor.b);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Plugin::applyDeepSpaceDotSettings(
+    std::string const& name, Settings::Trajectory const* settings) {
+
+  auto dot    = mDeepSpaceDots.find(name);
+  auto anchor = mAllSettings->mAnchors.find(name);
+
+  if (settings && settings->mDrawDot.value_or(false) && anchor == mAllSettings->mAnchors.end()) {
+    logger().warn(
+        "Cannot add planet mark for '{}': There is no such anchor defined in the settings!", name);
+  }
+
+  // Remove the DeepSpaceDot if it is not required anymore.
+  if (!settings || !settings->mDrawDot.value_or(false) || anchor == mAllSettings->mAnchors.end()) {
+    if (dot != mDeepSpaceDots.end()) {
+      mSolarSystem->unregisterAnchor(dot->second);
+      mDeepSpaceDotClusters->removeDot(dot->second);
+      mDeepSpaceDots.erase(dot);
+    }
+    return;
+  }
+
+  auto [tStartExistence, tEndExistence] = anchor->second.getExistence();
+
+  // Add the DeepSpaceDot or reconfigure the existing one.
+  if (dot == mDeepSpaceDots.end()) {
+    auto newDot = std::make_shared<DeepSpaceDot>(mPluginSettings, anchor->second.mCenter,
+        anchor->second.mFrame, tStartExistence, tEndExistence);
+    mSolarSystem->registerAnchor(newDot);
+
+    // do not perform distance culling for DeepSpaceDots
+    newDot->pVisibleRadius = -1;
+
+    // The visibility of the dot follows the trajectory, if there is one.
+    auto trajectory = mTrajectories.find(name);
+    newDot->pVisible =
+        trajectory == mTrajectories.end() || trajectory->second->pVisible.get();
+
+    mDeepSpaceDotClusters->addDot(newDot);
+    dot = mDeepSpaceDots.emplace(name, newDot).first;
+  } else {
+    dot->second->setCenterName(anchor->second.mCenter);
+    dot->second->setFrameName(anchor->second.mFrame);
+    dot->second->setStartExistence(tStartExistence);
+    dot->second->setEndExistence(tEndExistence);
+  }
+
+  dot->second->pColor = VistaColor(settings->mColor.r, settings->mColor.g, settings->mColor.b);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Plugin::applyTrajectorySettings(
+    std::string const& name, Settings::Trajectory const* settings) {
+
+  auto trajectory   = mTrajectories.find(name);
+  auto parentAnchor = mAllSettings->mAnchors.end();
+  auto targetAnchor = mAllSettings->mAnchors.find(name);
+
+  if (settings && settings->mTrail) {
+    parentAnchor = mAllSettings->mAnchors.find(settings->mTrail->mParent);
+
+    if (parentAnchor == mAllSettings->mAnchors.end()) {
+      logger().warn("Cannot add trajectory for '{}': There is no parent anchor '{}' defined in "
+                    "the settings!",
+          name, settings->mTrail->mParent);
+    } else if (targetAnchor == mAllSettings->mAnchors.end()) {
+      logger().warn(
+          "Cannot add trajectory for '{}': There is no such anchor defined in the settings!", name);
+    }
+  }
+
+  // Remove the trajectory if it is not required anymore or if it is wrongly configured.
+  if (!settings || !settings->mTrail || parentAnchor == mAllSettings->mAnchors.end() ||
+      targetAnchor == mAllSettings->mAnchors.end()) {
+    if (trajectory != mTrajectories.end()) {
+      trajectory->second->saveToCache();
+      mSolarSystem->unregisterAnchor(trajectory->second);
+      mTrajectories.erase(trajectory);
+
+      // Dots without a trajectory are always visible.
+      auto dot = mDeepSpaceDots.find(name);
+      if (dot != mDeepSpaceDots.end()) {
+        dot->second->pVisible = true;
+      }
+    }
+    return;
+  }
+
+  auto [parentStartExistence, parentEndExistence] = parentAnchor->second.getExistence();
+  auto [targetStartExistence, targetEndExistence] = targetAnchor->second.getExistence();
+
+  // Trajectories are quite expensive to construct, so existing ones are reconfigured. The
+  // properties and setters only discard the samples if a value actually changed.
+  if (trajectory == mTrajectories.end()) {
+    auto newTrajectory = std::make_shared<Trajectory>(mPluginSettings,
+        targetAnchor->second.mCenter, targetAnchor->second.mFrame, parentAnchor->second.mCenter,
+        parentAnchor->second.mFrame, std::max(parentStartExistence, targetStartExistence),
+        std::min(parentEndExistence, targetEndExistence));
+
+    // Change visibility of dots together with trajectory.
+    newTrajectory->pVisible.connectAndTouch([this, name](bool visible) {
+      auto dot = mDeepSpaceDots.find(name);
+      if (dot != mDeepSpaceDots.end()) {
+        dot->second->pVisible = visible;
+      }
+    });
+
+    mSolarSystem->registerAnchor(newTrajectory);
+
+    trajectory = mTrajectories.emplace(name, newTrajectory).first;
+  } else {
+    trajectory->second->setStartExistence(std::max(parentStartExistence, targetStartExistence));
+    trajectory->second->setEndExistence(std::min(parentEndExistence, targetEndExistence));
+    trajectory->second->setCenterName(parentAnchor->second.mCenter);
+    trajectory->second->setFrameName(parentAnchor->second.mFrame);
+    trajectory->second->setTargetCenterName(targetAnchor->second.mCenter);
+    trajectory->second->setTargetFrameName(targetAnchor->second.mFrame);
+  }
+
+  trajectory->second->pSamples = settings->mTrail->mSamples;
+  trajectory->second->pLength  = settings->mTrail->mLength;
+  trajectory->second->pPeriod  = settings->mTrail->mPeriod.value_or(0.0);
+  trajectory->second->pColor   = settings->mColor;
+  trajectory->second->setCache(mTrailCache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -13,11 +13,20 @@
 
 #include <VistaKernel/GraphicsManager/VistaOpenGLNode.h>
 #include <optional>
+#include <unordered_map>
 
 namespace csp::trajectories {
 
+class ClusterSync;
+class ConjunctionSearch;
 class DeepSpaceDot;
+class DeepSpaceDotClusters;
+class EphemerisWorkers;
+class SessionRecorder;
+class SessionReplay;
 class SunFlare;
+class ThreadPool;
+class TrailCache;
 class Trajectory;
 
 /// This plugin is providing HUD elements that display trajectories and markers for orbiting
@@ -44,6 +53,11 @@ class Plugin : public cs::core::PluginBase {
 
         /// The name of the anchor this trail is drawn relative to.
         std::string mParent;
+
+        /// If set, the target is assumed to move on a closed orbit with this period in days. One
+        /// full orbit is then sampled once and drawn as a static loop. The length of the trail
+        /// should not exceed the period.
+        std::optional<double> mPeriod;
       };
 
       /// Specifies the color of the trail and dot.
@@ -70,18 +84,244 @@ class Plugin : public cs::core::PluginBase {
 
     /// Toggles dots at runtime.
     cs::utils::DefaultProperty<bool> mEnablePlanetMarks{true};
+
+    /// Trails which have to be sampled from scratch (e.g. at start-up, after a settings reload or
+    /// after a time jump) are first sampled with this many samples only. The remaining samples are
+    /// interpolated and refined during the following frames.
+    cs::utils::DefaultProperty<int32_t> mWarmUpSamples{32};
+
+    /// The time in seconds it takes to refine coarsely sampled trails to full resolution. Set this
+    /// to zero to always sample trails at full resolution right away.
+    cs::utils::DefaultProperty<double> mWarmUpDuration{2.0};
+
+    /// By default, trails are not updated while the simulation time changes by more than a tenth of
+    /// their length from one frame to the next. If this is enabled, trails are updated in any case.
+    /// If more than mMaxSamplesPerFrame samples would be required, the trail is sampled coarsely
+    /// and refined during the following frames like during the warm-up.
+    cs::utils::DefaultProperty<bool> mEnableContinuousUpdates{false};
+
+    /// The maximum number of samples evaluated per trail and frame if continuous updates are
+    /// enabled. The same amount may be used for refining coarsely sampled trails.
+    cs::utils::DefaultProperty<int32_t> mMaxSamplesPerFrame{64};
+
+    /// If enabled, the velocity of the target is stored together with each sample and trails are
+    /// drawn with cubic Hermite segments between the samples. This gives smooth trails with far
+    /// fewer samples.
+    cs::utils::DefaultProperty<bool> mEnableHermiteTrails{false};
+
+    /// The approximate on-screen length in pixels of the linear pieces which are used to draw the
+    /// Hermite segments.
+    cs::utils::DefaultProperty<double> mHermiteSegmentPixels{4.0};
+
+    /// If enabled, trail samples are taken at integer multiples of the sample interval (counted
+    /// from J2000). Identically configured trails will then always use the same sample times, which
+    /// makes cached samples reusable regardless of the time at which a trail was sampled first.
+    cs::utils::DefaultProperty<bool> mAlignSamplesToTimeGrid{false};
+
+    /// With more than one level, the newest pSamples / mTrailDetailLevels samples of each trail are
+    /// taken densely, the next ones with half the density and so on. This puts most samples close
+    /// to the tip. Samples are reused as they move to the coarser levels.
+    cs::utils::DefaultProperty<int32_t> mTrailDetailLevels{1};
+
+    /// If enabled, the samples of each trail are kept on the GPU and only changed samples are
+    /// uploaded. The trails are transformed to the observer in the vertex shader. This is not used
+    /// for Hermite trails.
+    cs::utils::DefaultProperty<bool> mEnableResidentTrails{false};
+
+    /// If larger than zero, a trail is only sampled again once its tip is estimated to have moved
+    /// by at least this many pixels on screen since its last update. Slow trails are then updated
+    /// much less often than once per frame.
+    cs::utils::DefaultProperty<double> mUpdatePixelThreshold{0.0};
+
+    /// Periodic trails are sampled again if the actual position of the target deviates from the
+    /// loop by more than this fraction of the loop's radius.
+    cs::utils::DefaultProperty<double> mPeriodicDriftTolerance{0.001};
+
+    /// If set, sampled trails are stored in this directory when the plugin is unloaded. In the
+    /// next session, they are loaded from there instead of being sampled again.
+    std::optional<std::string> mCacheDirectory;
+
+    /// If the files in the cache directory use more than this many MiB, the least recently used
+    /// ones are deleted when the cache is created.
+    cs::utils::DefaultProperty<double> mCacheSizeLimit{256.0};
+
+    /// If larger than zero, the samples of the trails which have not been visible for the longest
+    /// time are freed once all trails together use more than this many MiB of host and GPU
+    /// memory. They are sampled again when they become visible.
+    cs::utils::DefaultProperty<double> mTrailMemoryBudget{0.0};
+
+    /// If larger than zero, the trails are sampled in parallel by this many worker threads in
+    /// addition to the main thread. As SPICE is not thread-safe, the ephemerides are evaluated by
+    /// worker processes then, see mEphemerisWorkers. This is ignored with cluster sync.
+    cs::utils::DefaultProperty<int32_t> mSamplingThreads{0};
+
+    /// If larger than zero, this many helper processes are started which load the same SPICE
+    /// kernels. Large batches of samples are then evaluated by all of them in parallel, and so are
+    /// smaller batches while another thread uses SPICE. If this is zero but mSamplingThreads is
+    /// set, one process per sampling thread is started. This is only supported on POSIX systems.
+    cs::utils::DefaultProperty<int32_t> mEphemerisWorkers{0};
+
+    /// If larger than zero, all close approaches between trails which are closer than this many
+    /// kilometers are searched, see getConjunctions().
+    cs::utils::DefaultProperty<double> mConjunctionDistance{0.0};
+
+    /// The duration in hours of the time buckets used for the conjunction search. Ideally, each
+    /// bucket contains only a few samples of each trail.
+    cs::utils::DefaultProperty<double> mConjunctionBucketDuration{24.0};
+
+    /// If enabled and CosmoScout VR runs in cluster mode, trails are only sampled on the leader
+    /// node. The new samples are sent to all follower nodes each frame.
+    cs::utils::DefaultProperty<bool> mEnableClusterSync{false};
+
+    /// If enabled, planet marks whose projected positions are closer than
+    /// mPlanetMarkClusterPixels are merged into one marker.
+    cs::utils::DefaultProperty<bool> mEnablePlanetMarkClustering{false};
+
+    /// The size in pixels of the screen-space grid cells used for clustering planet marks.
+    cs::utils::DefaultProperty<double> mPlanetMarkClusterPixels{8.0};
+
+    /// If enabled, sun flares read their glow profile from a precomputed texture instead of
+    /// evaluating it for each pixel.
+    cs::utils::DefaultProperty<bool> mEnableFastSunFlares{false};
+
+    /// If set, the simulation time and the observer of each frame and all reloads of these
+    /// settings are written to this file. See SessionRecorder for details.
+    std::optional<std::string> mRecordFile;
+
+    /// If set, the given recording is replayed once after the settings have been loaded. The CPU
+    /// time of each replayed frame is written to a CSV file next to the recording.
+    std::optional<std::string> mReplayFile;
+
+    /// If set, CosmoScout VR quits once the replay has finished. The exit code is non-zero if the
+    /// replay failed, for example because memory was allocated after the warm-up.
+    cs::utils::DefaultProperty<bool> mExitAfterReplay{false};
+  };
+
+  /// A point on a trail, see pickTrail() and getNearestTrailPoint().
+  struct TrailPoint {
+    std::string mTrajectory; ///< The name of the trajectory's anchor.
+    double      mTime{};     ///< The interpolated simulation time at the point.
+    glm::dvec3  mPosition{}; ///< The point in world space.
+  };
+
+  /// A close approach of two trails, see getConjunctions().
+  struct Conjunction {
+    std::string mTrajectoryA; ///< The name of the first trajectory's anchor.
+    std::string mTrajectoryB; ///< The name of the second trajectory's anchor.
+    double      mTime{};      ///< The interpolated simulation time of the closest approach.
+    double      mDistance{};  ///< The distance of the targets at this time in meters.
+  };
+
+  /// A read-only view of the samples of a trail, see getTrailView(). Each sample contains the
+  /// position relative to the trail's parent in meters and the time of the sample. The samples of
+  /// mOlder are followed by those of mNewer in chronological order. Samples for which no data was
+  /// available may be out of order and should be skipped.
+  ///
+  /// The view points directly to the samples of the trail, so it is only valid as long as the
+  /// generation of the trail does not change. Trails are sampled in this plugin's update() and
+  /// when the SolarSystem updates its objects, and sampling may reallocate or free the samples.
+  /// Hence, a view must not be read after control has been returned to CosmoScout VR. A view
+  /// which is kept across frames has to be checked with isTrailViewValid() before each use.
+  struct TrailView {
+    struct Span {
+      glm::dvec4 const* mData{};
+      size_t            mSize{};
+    };
+
+    uint64_t    mGeneration{}; ///< Changes whenever the samples or their order change.
+    std::string mParentCenter; ///< The SPICE center the positions are relative to.
+    std::string mParentFrame;  ///< The SPICE frame the positions are given in.
+    Span        mOlder;        ///< The oldest samples.
+    Span        mNewer;        ///< The newest samples.
   };
 
   void init() override;
   void deInit() override;
+  void update() override;
+
+  /// Returns the point of all currently drawn trails which is closest to the given world-space ray
+  /// in terms of angle, if this angle is smaller than maxAngle (in radians). This can be used for
+  /// hover and selection with a mouse ray.
+  std::optional<TrailPoint> pickTrail(
+      glm::dvec3 const& rayOrigin, glm::dvec3 const& rayDirection, double maxAngle) const;
+
+  /// Returns the point of all currently drawn trails which is closest to the given world-space
+  /// position, if it is closer than maxDistance.
+  std::optional<TrailPoint> getNearestTrailPoint(
+      glm::dvec3 const& position, double maxDistance) const;
+
+  /// Returns a view of the samples of the trail of the given anchor without copying them. This
+  /// returns std::nullopt if there is no such trail.
+  std::optional<TrailView> getTrailView(std::string const& name) const;
+
+  /// Returns the current generation of the trail of the given anchor. If it is the same as the
+  /// generation of a previously requested view, the view is still valid and the samples did not
+  /// change. Generations are unique across all trails, also if a trail is removed and created
+  /// again.
+  std::optional<uint64_t> getTrailGeneration(std::string const& name) const;
+
+  /// Returns true if the trail of the given anchor still exists and its samples did not change
+  /// since the given view was requested. Only then the view may be read.
+  bool isTrailViewValid(std::string const& name, TrailView const& view) const;
+
+  /// Returns all close approaches between the samples of the trails which are closer than
+  /// conjunctionDistance. Only trails with the same parent center and frame are compared. The list
+  /// is updated incrementally once per frame as new samples arrive.
+  std::vector<Conjunction> const& getConjunctions() const;
+
+  /// Adds the trajectory, planet mark and sun flare of the given anchor or reconfigures the
+  /// existing ones. Only the objects of this anchor are touched. The settings are also stored in
+  /// the plugin's settings, so they are saved together with the scene.
+  void setTrajectory(std::string const& name, Settings::Trajectory const& settings);
+
+  /// Removes the trajectory, planet mark and sun flare of the given anchor.
+  void removeTrajectory(std::string const& name);
+
+  /// Draws the trail of the given anchor relative to another anchor.
+  void setTrailParent(std::string const& name, std::string const& parent);
 
  private:
   void onLoad();
 
-  std::shared_ptr<Settings>                          mPluginSettings = std::make_shared<Settings>();
-  std::map<std::string, std::shared_ptr<Trajectory>> mTrajectories;
-  std::map<std::string, std::shared_ptr<DeepSpaceDot>> mDeepSpaceDots;
-  std::map<std::string, std::shared_ptr<SunFlare>>     mSunFlares;
+  /// Evicts the samples of the least recently visible trajectories until all trajectories
+  /// together use less than the given number of bytes.
+  void enforceMemoryBudget(size_t budget);
+
+  /// Samples all trajectories which need new samples on the thread pool. If threadCount is zero,
+  /// the pool is destroyed and the trajectories sample themselves again.
+  void updateSamplesInParallel(double tTime, size_t threadCount);
+
+  /// These create, reconfigure or remove the objects of the given anchor so that they match the
+  /// given settings. If the settings are a nullptr, all objects of the anchor are removed.
+  void applySettings(std::string const& name, Settings::Trajectory const* settings);
+  void applySunFlareSettings(std::string const& name, Settings::Trajectory const* settings);
+  void applyDeepSpaceDotSettings(std::string const& name, Settings::Trajectory const* settings);
+  void applyTrajectorySettings(std::string const& name, Settings::Trajectory const* settings);
+
+  std::shared_ptr<Settings>          mPluginSettings = std::make_shared<Settings>();
+  std::shared_ptr<TrailCache>        mTrailCache;
+  std::unique_ptr<ClusterSync>       mClusterSync;
+  std::unique_ptr<SessionRecorder>   mRecorder;
+  std::unique_ptr<SessionReplay>     mReplay;
+  std::unique_ptr<ThreadPool>        mThreadPool;
+  std::shared_ptr<EphemerisWorkers>  mEphemerisWorkers;
+  std::unique_ptr<ConjunctionSearch> mConjunctionSearch;
+
+  /// The tasks of the thread pool. This is kept to reuse its memory in each frame.
+  std::vector<std::function<void()>> mSamplingTasks;
+
+  /// The trajectories which may be evicted by enforceMemoryBudget(). This is kept to reuse its
+  /// memory in each frame.
+  std::vector<Trajectory*> mEvictionCandidates;
+
+  std::unordered_map<std::string, std::shared_ptr<Trajectory>>   mTrajectories;
+  std::unordered_map<std::string, std::shared_ptr<DeepSpaceDot>> mDeepSpaceDots;
+  std::unique_ptr<DeepSpaceDotClusters>                          mDeepSpaceDotClusters;
+  std::unordered_map<std::string, std::shared_ptr<SunFlare>>     mSunFlares;
+
+  /// The replay file which has been replayed last. A replay is only started again if this changes.
+  std::string mLastReplayFile;
+  bool        mIsReplaying = false;
 
   int mOnLoadConnection = -1;
   int mOnSaveConnection = -1;
@@ -0,0 +1,436 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "SegmentBVH.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const double INF = std::numeric_limits<double>::infinity();
+
+// The maximum depth of the tree is 64, as there cannot be more than 2^64 segments. A depth-first
+// traversal never needs more than one stack entry per level plus one.
+const size_t MAX_STACK_SIZE = 66;
+
+// Hermite segments are approximated by this many straight pieces when they are tested against a
+// query.
+const int HERMITE_PIECES = 8;
+
+// Returns the parameters of the closest points on the segment a-b and on the ray o+t*d. The
+// direction d has to be normalized.
+void getClosestPoints(glm::dvec3 const& a, glm::dvec3 const& b, glm::dvec3 const& o,
+    glm::dvec3 const& d, double& s, double& t) {
+  glm::dvec3 u  = b - a;
+  glm::dvec3 w  = a - o;
+  double     uu = glm::dot(u, u);
+  double     ud = glm::dot(u, d);
+  double     uw = glm::dot(u, w);
+  double     dw = glm::dot(d, w);
+
+  double denominator = uu - ud * ud;
+  s = (denominator > 1e-12 * uu) ? glm::clamp((ud * dw - uw) / denominator, 0.0, 1.0) : 0.0;
+  t = std::max(0.0, glm::dot(a + s * u - o, d));
+
+  // The ray parameter may have been clamped, so find the best point on the segment again.
+  if (uu > 0.0) {
+    s = glm::clamp(glm::dot(o + t * d - a, u) / uu, 0.0, 1.0);
+  }
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SegmentBVH::invalidate(size_t slot) {
+  if (!mRebuild) {
+    mDirtySlots.push_back(slot);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SegmentBVH::invalidateAll() {
+  mRebuild = true;
+  mDirtySlots.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SegmentBVH::clear() {
+  std::vector<Box>().swap(mNodes);
+  std::vector<size_t>().swap(mDirtySlots);
+  mSegmentCount = 0;
+  mLeafOffset   = 0;
+  mRebuild      = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t SegmentBVH::getMemoryUsage() const {
+  return mNodes.capacity() * sizeof(Box) + mDirtySlots.capacity() * sizeof(size_t);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SegmentBVH::refit(std::vector<glm::dvec4> const& points,
+    std::vector<glm::dvec3> const& velocities, double maxSegmentDuration, double period) {
+  bool hasVelocities = !velocities.empty();
+
+  if (points.size() != mSegmentCount || maxSegmentDuration != mMaxSegmentDuration ||
+      period != mPeriod || hasVelocities != mHasVelocities) {
+    mSegmentCount       = points.size();
+    mMaxSegmentDuration = maxSegmentDuration;
+    mPeriod             = period;
+    mHasVelocities      = hasVelocities;
+    mRebuild            = true;
+  }
+
+  // If many samples changed, rebuilding the entire tree in O(N) is cheaper than refitting each
+  // path in O(log N).
+  if (mDirtySlots.size() * 8 > mSegmentCount) {
+    mRebuild = true;
+  }
+
+  if (mRebuild) {
+    mLeafOffset = 1;
+    while (mLeafOffset < mSegmentCount) {
+      mLeafOffset *= 2;
+    }
+
+    mNodes.assign(2 * mLeafOffset, Box{glm::dvec3(INF), glm::dvec3(-INF)});
+
+    for (size_t i = 0; i < mSegmentCount; ++i) {
+      updateLeaf(points, velocities, i);
+    }
+
+    for (size_t node = mLeafOffset - 1; node > 0; --node) {
+      updateNode(node);
+    }
+
+    mDirtySlots.clear();
+    mRebuild = false;
+    return;
+  }
+
+  for (size_t slot : mDirtySlots) {
+    if (slot >= mSegmentCount) {
+      continue;
+    }
+
+    // A changed sample affects the segment ending in it and the segment starting at it.
+    size_t previous = (slot + mSegmentCount - 1) % mSegmentCount;
+
+    for (size_t segment : {previous, slot}) {
+      updateLeaf(points, velocities, segment);
+
+      for (size_t node = (mLeafOffset + segment) / 2; node > 0; node /= 2) {
+        updateNode(node);
+      }
+    }
+  }
+
+  mDirtySlots.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<SegmentBVH::Hit> SegmentBVH::intersect(std::vector<glm::dvec4> const& points,
+    std::vector<glm::dvec3> const& velocities, TimeWindow const& window, glm::dvec3 const& origin,
+    glm::dvec3 const& direction, double maxAngle) const {
+
+  if (mNodes.empty() || mSegmentCount != points.size() ||
+      velocities.size() != (mHasVelocities ? points.size() : 0)) {
+    return std::nullopt;
+  }
+
+  std::optional<Hit> best;
+  double             bestAngle = maxAngle;
+
+  std::array<size_t, MAX_STACK_SIZE> stack{};
+  size_t                             stackSize = 0;
+  stack[stackSize++]                           = 1;
+
+  while (stackSize > 0) {
+    size_t     node = stack[--stackSize];
+    Box const& box  = mNodes[node];
+
+    if (box.mMin.x > box.mMax.x) {
+      continue;
+    }
+
+    // All points on the ray which are closer than the current best angle to the box lie within
+    // the box inflated by this radius.
+    glm::dvec3 center = (box.mMin + box.mMax) * 0.5;
+    double     radius = bestAngle * (glm::length(center - origin) +
+                                    glm::length(box.mMax - box.mMin) * 0.5);
+
+    // Slab test of the ray against the inflated box.
+    double tMin = 0.0;
+    double tMax = INF;
+
+    for (int i = 0; i < 3 && tMin <= tMax; ++i) {
+      double lower = box.mMin[i] - radius - origin[i];
+      double upper = box.mMax[i] + radius - origin[i];
+
+      if (direction[i] == 0.0) {
+        if (lower > 0.0 || upper < 0.0) {
+          tMin = INF;
+        }
+      } else {
+        double t0 = lower / direction[i];
+        double t1 = upper / direction[i];
+        tMin      = std::max(tMin, std::min(t0, t1));
+        tMax      = std::min(tMax, std::max(t0, t1));
+      }
+    }
+
+    if (tMin > tMax) {
+      continue;
+    }
+
+    if (node < mLeafOffset) {
+      stack[stackSize++] = 2 * node;
+      stack[stackSize++] = 2 * node + 1;
+      continue;
+    }
+
+    size_t segment = node - mLeafOffset;
+    double sMin{};
+    double sMax{};
+    double timeOffset{};
+
+    if (!getVisibleRange(points, segment, window, sMin, sMax, timeOffset)) {
+      continue;
+    }
+
+    // Only the visible part of the segment is tested. Hermite segments are split into pieces.
+    int        pieces = mHasVelocities ? HERMITE_PIECES : 1;
+    glm::dvec3 a      = getPoint(points, velocities, segment, sMin);
+
+    for (int i = 1; i <= pieces; ++i) {
+      double     s0 = glm::mix(sMin, sMax, static_cast<double>(i - 1) / pieces);
+      double     s1 = glm::mix(sMin, sMax, static_cast<double>(i) / pieces);
+      glm::dvec3 b  = getPoint(points, velocities, segment, s1);
+
+      double s{};
+      double t{};
+      getClosestPoints(a, b, origin, direction, s, t);
+
+      glm::dvec3 point = a + s * (b - a);
+      double     angle = (t > 0.0) ? glm::length(point - (origin + t * direction)) / t : INF;
+
+      if (angle < bestAngle) {
+        double parameter = glm::mix(s0, s1, s);
+        double time      = points[segment].w + parameter * getDuration(points, segment);
+        bestAngle        = angle;
+        best             = Hit{segment, parameter, angle, time + timeOffset, point};
+      }
+
+      a = b;
+    }
+  }
+
+  return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<SegmentBVH::Hit> SegmentBVH::getNearest(std::vector<glm::dvec4> const& points,
+    std::vector<glm::dvec3> const& velocities, TimeWindow const& window,
+    glm::dvec3 const& position, double maxDistance) const {
+
+  if (mNodes.empty() || mSegmentCount != points.size() ||
+      velocities.size() != (mHasVelocities ? points.size() : 0)) {
+    return std::nullopt;
+  }
+
+  std::optional<Hit> best;
+  double             bestDistance = maxDistance;
+
+  std::array<size_t, MAX_STACK_SIZE> stack{};
+  size_t                             stackSize = 0;
+  stack[stackSize++]                           = 1;
+
+  while (stackSize > 0) {
+    size_t     node = stack[--stackSize];
+    Box const& box  = mNodes[node];
+
+    if (box.mMin.x > box.mMax.x) {
+      continue;
+    }
+
+    glm::dvec3 closest = glm::clamp(position, box.mMin, box.mMax);
+
+    if (glm::length(closest - position) >= bestDistance) {
+      continue;
+    }
+
+    if (node < mLeafOffset) {
+      // Visit the closer child first, as it is more likely to shrink bestDistance.
+      Box const& left    = mNodes[2 * node];
+      Box const& right   = mNodes[2 * node + 1];
+      double     toLeft  = glm::length(glm::clamp(position, left.mMin, left.mMax) - position);
+      double     toRight = glm::length(glm::clamp(position, right.mMin, right.mMax) - position);
+
+      stack[stackSize++] = toLeft < toRight ? 2 * node + 1 : 2 * node;
+      stack[stackSize++] = toLeft < toRight ? 2 * node : 2 * node + 1;
+      continue;
+    }
+
+    size_t segment = node - mLeafOffset;
+    double sMin{};
+    double sMax{};
+    double timeOffset{};
+
+    if (!getVisibleRange(points, segment, window, sMin, sMax, timeOffset)) {
+      continue;
+    }
+
+    // See intersect().
+    int        pieces = mHasVelocities ? HERMITE_PIECES : 1;
+    glm::dvec3 a      = getPoint(points, velocities, segment, sMin);
+
+    for (int i = 1; i <= pieces; ++i) {
+      double     s0 = glm::mix(sMin, sMax, static_cast<double>(i - 1) / pieces);
+      double     s1 = glm::mix(sMin, sMax, static_cast<double>(i) / pieces);
+      glm::dvec3 b  = getPoint(points, velocities, segment, s1);
+      glm::dvec3 u  = b - a;
+      double     uu = glm::dot(u, u);
+      double     s  = (uu > 0.0) ? glm::clamp(glm::dot(position - a, u) / uu, 0.0, 1.0) : 0.0;
+
+      glm::dvec3 point    = a + s * u;
+      double     distance = glm::length(point - position);
+
+      if (distance < bestDistance) {
+        double parameter = glm::mix(s0, s1, s);
+        double time      = points[segment].w + parameter * getDuration(points, segment);
+        bestDistance     = distance;
+        best             = Hit{segment, parameter, distance, time + timeOffset, point};
+      }
+
+      a = b;
+    }
+  }
+
+  return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double SegmentBVH::getDuration(std::vector<glm::dvec4> const& points, size_t segment) const {
+  double dt = points[(segment + 1) % mSegmentCount].w - points[segment].w;
+
+  // At the seam of a periodic loop, the time jumps back by one period.
+  if (mPeriod > 0.0 && dt <= 0.0) {
+    dt += mPeriod;
+  }
+
+  return dt;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SegmentBVH::isValid(std::vector<glm::dvec4> const& points, size_t segment) const {
+  if (mSegmentCount < 2) {
+    return false;
+  }
+
+  double dt = getDuration(points, segment);
+  return dt > 0.0 && dt <= mMaxSegmentDuration;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+glm::dvec3 SegmentBVH::getPoint(std::vector<glm::dvec4> const& points,
+    std::vector<glm::dvec3> const& velocities, size_t segment, double s) const {
+
+  size_t     next = (segment + 1) % mSegmentCount;
+  glm::dvec3 p0   = glm::dvec3(points[segment]);
+  glm::dvec3 p1   = glm::dvec3(points[next]);
+
+  if (!mHasVelocities) {
+    return glm::mix(p0, p1, s);
+  }
+
+  // This is the same curve as drawn by Trajectory::tessellate().
+  double     dt = getDuration(points, segment);
+  glm::dvec3 m0 = velocities[segment] * dt;
+  glm::dvec3 m1 = velocities[next] * dt;
+  double     s2 = s * s;
+  double     s3 = s2 * s;
+
+  return (2.0 * s3 - 3.0 * s2 + 1.0) * p0 + (s3 - 2.0 * s2 + s) * m0 + (-2.0 * s3 + 3.0 * s2) * p1 +
+         (s3 - s2) * m1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SegmentBVH::getVisibleRange(std::vector<glm::dvec4> const& points, size_t segment,
+    TimeWindow const& window, double& sMin, double& sMax, double& timeOffset) const {
+
+  double t0 = points[segment].w;
+  double dt = getDuration(points, segment);
+
+  // For periodic trails, the window is moved back by whole periods until its end is just after
+  // the end of the segment. The times of the segment are moved by the same amount in the other
+  // direction.
+  timeOffset = 0.0;
+  if (mPeriod > 0.0) {
+    timeOffset = mPeriod * std::floor((window.mEnd - (t0 + dt)) / mPeriod);
+  }
+
+  sMin = std::max(0.0, (window.mStart - timeOffset - t0) / dt);
+  sMax = std::min(1.0, (window.mEnd - timeOffset - t0) / dt);
+
+  return sMin <= sMax;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SegmentBVH::updateLeaf(std::vector<glm::dvec4> const& points,
+    std::vector<glm::dvec3> const& velocities, size_t segment) {
+
+  Box& box = mNodes[mLeafOffset + segment];
+
+  if (!isValid(points, segment)) {
+    box = Box{glm::dvec3(INF), glm::dvec3(-INF)};
+    return;
+  }
+
+  size_t     next = (segment + 1) % mSegmentCount;
+  glm::dvec3 a    = glm::dvec3(points[segment]);
+  glm::dvec3 b    = glm::dvec3(points[next]);
+  box             = Box{glm::min(a, b), glm::max(a, b)};
+
+  // A Hermite segment lies within the convex hull of its Bezier control points.
+  if (mHasVelocities) {
+    double     dt = getDuration(points, segment);
+    glm::dvec3 c0 = a + velocities[segment] * dt / 3.0;
+    glm::dvec3 c1 = b - velocities[next] * dt / 3.0;
+    box.mMin      = glm::min(box.mMin, glm::min(c0, c1));
+    box.mMax      = glm::max(box.mMax, glm::max(c0, c1));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SegmentBVH::updateNode(size_t node) {
+  Box const& left  = mNodes[2 * node];
+  Box const& right = mNodes[2 * node + 1];
+  mNodes[node]     = Box{glm::min(left.mMin, right.mMin), glm::max(left.mMax, right.mMax)};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_SEGMENT_BVH_HPP
+#define CSP_TRAJECTORIES_SEGMENT_BVH_HPP
+
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+namespace csp::trajectories {
+
+/// A bounding volume hierarchy over the line segments of a trail. Segment i connects the samples
+/// in ring-buffer slots i and i + 1 (wrapping around at the end). A segment is only valid if its
+/// second sample directly follows the first one in time, so the segment between the newest and the
+/// oldest sample is ignored automatically. For periodic trails, the samples form a closed loop and
+/// the segment from the newest sample back to the oldest one is valid as well. If velocities are
+/// given for the samples, the segments are cubic Hermite curves instead of straight lines.
+///
+/// The hierarchy is an implicit complete binary tree stored in an array: node 1 is the root, the
+/// children of node n are 2n and 2n + 1 and segment i is stored in leaf node L + i, where L is the
+/// number of segments rounded up to a power of two. When samples change, only the boxes on the
+/// paths from the affected leaves to the root are refitted.
+class SegmentBVH {
+ public:
+  /// A point on a segment.
+  struct Hit {
+    size_t     mSegment{};   ///< The index of the first sample of the segment.
+    double     mParameter{}; ///< Where on the segment the point lies, between 0 and 1.
+    double     mError{};     ///< The angle or the distance to the query, see below.
+    double     mTime{};      ///< The time of the point, moved into the time window of the query.
+    glm::dvec3 mPosition{};  ///< The point itself.
+  };
+
+  /// Only the parts of the segments whose time lies within this window can be hit. For periodic
+  /// trails, the window is repeated once per period.
+  struct TimeWindow {
+    double mStart{};
+    double mEnd{};
+  };
+
+  /// Marks the segments adjacent to the given slot for refitting.
+  void invalidate(size_t slot);
+
+  /// Rebuilds the entire hierarchy on the next call to refit().
+  void invalidateAll();
+
+  /// Frees all memory. The hierarchy is rebuilt on the next call to refit().
+  void clear();
+
+  /// Returns the number of bytes allocated for the hierarchy.
+  size_t getMemoryUsage() const;
+
+  /// Updates the bounding boxes of all invalidated segments. Segments whose samples are more than
+  /// maxSegmentDuration apart are considered invalid. If the period is larger than zero, the time
+  /// of the oldest sample plus the period follows the newest sample. The velocities are either
+  /// empty or contain one entry per sample. The same vectors have to be passed to the queries.
+  void refit(std::vector<glm::dvec4> const& points, std::vector<glm::dvec3> const& velocities,
+      double maxSegmentDuration, double period);
+
+  /// Returns the point on the trail with the smallest angular distance to the given ray, if this
+  /// angle is below maxAngle (in radians). The error of the hit is this angle. The direction has to
+  /// be normalized.
+  std::optional<Hit> intersect(std::vector<glm::dvec4> const& points,
+      std::vector<glm::dvec3> const& velocities, TimeWindow const& window,
+      glm::dvec3 const& origin, glm::dvec3 const& direction, double maxAngle) const;
+
+  /// Returns the point on the trail which is closest to the given position, if its distance is
+  /// below maxDistance. The error of the hit is this distance.
+  std::optional<Hit> getNearest(std::vector<glm::dvec4> const& points,
+      std::vector<glm::dvec3> const& velocities, TimeWindow const& window,
+      glm::dvec3 const& position, double maxDistance) const;
+
+ private:
+  struct Box {
+    glm::dvec3 mMin{};
+    glm::dvec3 mMax{};
+  };
+
+  double getDuration(std::vector<glm::dvec4> const& points, size_t segment) const;
+  bool   isValid(std::vector<glm::dvec4> const& points, size_t segment) const;
+
+  /// Returns the point at the given parameter of the segment.
+  glm::dvec3 getPoint(std::vector<glm::dvec4> const& points,
+      std::vector<glm::dvec3> const& velocities, size_t segment, double s) const;
+
+  /// Computes the range of parameters of the segment which lies within the time window. Returns
+  /// false if this range is empty. The time offset moves the times of the segment into the window.
+  bool getVisibleRange(std::vector<glm::dvec4> const& points, size_t segment,
+      TimeWindow const& window, double& sMin, double& sMax, double& timeOffset) const;
+
+  void updateLeaf(std::vector<glm::dvec4> const& points,
+      std::vector<glm::dvec3> const& velocities, size_t segment);
+  void updateNode(size_t node);
+
+  std::vector<Box>    mNodes;
+  std::vector<size_t> mDirtySlots;
+  size_t              mSegmentCount       = 0;
+  size_t              mLeafOffset         = 0;
+  double              mMaxSegmentDuration = 0.0;
+  double              mPeriod             = 0.0;
+  bool                mHasVelocities      = false;
+  bool                mRebuild            = true;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_SEGMENT_BVH_HPP
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "SessionRecorder.hpp"
+
+#include "logger.hpp"
+
+#include "../../../src/cs-scene/CelestialObserver.hpp"
+
+#include <glm/gtc/quaternion.hpp>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SessionRecorder::SessionRecorder(std::string const& fileName)
+    : mFileName(fileName)
+    , mStream(fileName, std::ios::trunc) {
+
+  if (!mStream) {
+    logger().warn("Failed to open session recording '{}' for writing!", mFileName);
+  } else {
+    logger().info("Recording session to '{}'.", mFileName);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string const& SessionRecorder::getFileName() const {
+  return mFileName;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SessionRecorder::recordFrame(double tTime, cs::scene::CelestialObserver const& observer) {
+  if (!mStream) {
+    return;
+  }
+
+  glm::dvec3 const& position = observer.getAnchorPosition();
+  glm::dquat const& rotation = observer.getAnchorRotation();
+
+  nlohmann::json frame;
+  frame["time"]     = tTime;
+  frame["center"]   = observer.getCenterName();
+  frame["frame"]    = observer.getFrameName();
+  frame["position"] = {position.x, position.y, position.z};
+  frame["rotation"] = {rotation.w, rotation.x, rotation.y, rotation.z};
+  frame["scale"]    = observer.getAnchorScale();
+
+  mStream << frame.dump() << '\n';
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SessionRecorder::recordSettings(nlohmann::json settings) {
+  if (!mStream) {
+    return;
+  }
+
+  settings.erase("recordFile");
+  settings.erase("replayFile");
+
+  nlohmann::json event;
+  event["settings"] = std::move(settings);
+
+  // Settings reloads are rare, so the stream is flushed to make sure that they end up in the file
+  // even if the application crashes.
+  mStream << event.dump() << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
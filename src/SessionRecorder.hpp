@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_SESSION_RECORDER_HPP
+#define CSP_TRAJECTORIES_SESSION_RECORDER_HPP
+
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace cs::scene {
+class CelestialObserver;
+}
+
+namespace csp::trajectories {
+
+/// The SessionRecorder writes everything which influences the per-frame work of the plugin to a
+/// file: the simulation time and the observer of each frame and each reload of the plugin's
+/// settings. Such a recording can be replayed with the SessionReplay in order to reproduce
+/// performance problems of a specific session.
+///
+/// The file contains one JSON object per line. Frames look like this:
+/// {"time": <double>, "center": <string>, "frame": <string>, "position": [x, y, z],
+///  "rotation": [w, x, y, z], "scale": <double>}
+/// Settings reloads look like this: {"settings": <the plugin's settings>}
+class SessionRecorder {
+ public:
+  /// The file is overwritten if it exists.
+  explicit SessionRecorder(std::string const& fileName);
+
+  SessionRecorder(SessionRecorder const& other) = delete;
+  SessionRecorder(SessionRecorder&& other)      = delete;
+
+  SessionRecorder& operator=(SessionRecorder const& other) = delete;
+  SessionRecorder& operator=(SessionRecorder&& other) = delete;
+
+  ~SessionRecorder() = default;
+
+  std::string const& getFileName() const;
+
+  /// Records the inputs of one frame.
+  void recordFrame(double tTime, cs::scene::CelestialObserver const& observer);
+
+  /// Records a reload of the plugin's settings. The recording and replay settings are removed, so
+  /// that replaying the recording does not start another recording.
+  void recordSettings(nlohmann::json settings);
+
+ private:
+  std::string   mFileName;
+  std::ofstream mStream;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_SESSION_RECORDER_HPP
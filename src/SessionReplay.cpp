@@ -0,0 +1,244 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "SessionReplay.hpp"
+
+#include "DeepSpaceDot.hpp"
+#include "SunFlare.hpp"
+#include "Trajectory.hpp"
+#include "logger.hpp"
+
+#include "../../../src/cs-scene/CelestialObserver.hpp"
+
+#ifdef CSP_TRAJECTORIES_COUNT_ALLOCATIONS
+#include "AllocationCounter.hpp"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <glm/gtc/quaternion.hpp>
+#include <optional>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// After the start of the replay and after each settings reload, the objects allocate their buffers
+// during this many frames. Allocations in these frames are not reported.
+const size_t WARM_UP_FRAMES = 10;
+
+// Returns the number of heap allocations of the calling thread so far, or std::nullopt if they are
+// not counted. See AllocationCounter.hpp.
+std::optional<uint64_t> getAllocationCount() {
+#ifdef CSP_TRAJECTORIES_COUNT_ALLOCATIONS
+  return cspTrajectoriesGetAllocationCount();
+#else
+  return std::nullopt;
+#endif
+}
+
+// Returns true if allocations are actually counted. This is not the case if the counter library
+// has not been preloaded.
+bool isCountingAllocations() {
+  // Unlike a new-expression, a direct call of the operator cannot be optimized away.
+  auto  before = getAllocationCount();
+  void* probe  = ::operator new(1);
+  auto  after  = getAllocationCount();
+  ::operator delete(probe);
+
+  return before && after && *after > *before;
+}
+
+// Returns the time in milliseconds it took to call the given function.
+template <typename F>
+double measure(F const& function) {
+  auto start = std::chrono::steady_clock::now();
+  function();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Returns the given percentile of the sorted values.
+double getPercentile(std::vector<double> const& sorted, double percentile) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+
+  auto index = static_cast<size_t>(percentile * static_cast<double>(sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SessionReplay::SessionReplay(std::string const& fileName)
+    : mFileName(fileName) {
+
+  std::ifstream stream(fileName);
+
+  if (!stream) {
+    logger().warn("Failed to open session recording '{}'!", fileName);
+    return;
+  }
+
+  std::string line;
+  size_t      lineNumber = 0;
+
+  while (std::getline(stream, line)) {
+    ++lineNumber;
+
+    if (line.empty()) {
+      continue;
+    }
+
+    try {
+      mEvents.push_back(nlohmann::json::parse(line));
+    } catch (std::exception const& e) {
+      logger().warn(
+          "Skipping line {} of session recording '{}': {}", lineNumber, fileName, e.what());
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SessionReplay::run(SettingsCallback const&                             applySettings,
+    std::unordered_map<std::string, std::shared_ptr<Trajectory>> const&   trajectories,
+    std::unordered_map<std::string, std::shared_ptr<DeepSpaceDot>> const& dots,
+    std::unordered_map<std::string, std::shared_ptr<SunFlare>> const&     flares) const {
+
+  logger().info("Replaying session recording '{}'...", mFileName);
+
+  bool countAllocations = isCountingAllocations();
+
+#ifdef CSP_TRAJECTORIES_COUNT_ALLOCATIONS
+  if (!countAllocations) {
+    logger().warn("Allocations are not counted, as the allocation counter library has not been "
+                  "preloaded. See AllocationCounter.hpp for details.");
+  }
+#endif
+
+  std::ofstream report(mFileName + ".report.csv", std::ios::trunc);
+  report << "frame,time,trajectories,dots,flares,total" << (countAllocations ? ",allocations" : "")
+         << std::endl;
+
+  cs::scene::CelestialObserver observer;
+  std::vector<double>          totals;
+  size_t                       frame = 0;
+
+  // The remaining frames of the warm-up and the frames which allocated memory after it.
+  size_t warmUpFrames     = WARM_UP_FRAMES;
+  size_t allocatingFrames = 0;
+  size_t firstAllocatingFrame{};
+
+  for (auto const& event : mEvents) {
+    try {
+      if (event.contains("settings")) {
+        applySettings(event.at("settings"));
+        warmUpFrames = WARM_UP_FRAMES;
+        continue;
+      }
+
+      auto position = event.at("position").get<std::vector<double>>();
+      auto rotation = event.at("rotation").get<std::vector<double>>();
+      auto tTime    = event.at("time").get<double>();
+
+      observer.setCenterName(event.at("center").get<std::string>());
+      observer.setFrameName(event.at("frame").get<std::string>());
+      observer.setAnchorPosition(glm::dvec3(position.at(0), position.at(1), position.at(2)));
+      observer.setAnchorRotation(
+          glm::dquat(rotation.at(0), rotation.at(1), rotation.at(2), rotation.at(3)));
+      observer.setAnchorScale(event.at("scale").get<double>());
+
+      auto allocationsBefore = getAllocationCount();
+
+      double trajectoryCost = measure([&]() {
+        for (auto const& trajectory : trajectories) {
+          trajectory.second->update(tTime, observer);
+        }
+      });
+
+      double dotCost = measure([&]() {
+        for (auto const& dot : dots) {
+          dot.second->update(tTime, observer);
+        }
+      });
+
+      double flareCost = measure([&]() {
+        for (auto const& flare : flares) {
+          flare.second->update(tTime, observer);
+        }
+      });
+
+      auto allocationsAfter = getAllocationCount();
+
+      double total = trajectoryCost + dotCost + flareCost;
+      totals.push_back(total);
+
+      report << frame << "," << std::to_string(tTime) << "," << trajectoryCost << ","
+             << dotCost << "," << flareCost << "," << total;
+
+      if (countAllocations) {
+        uint64_t allocations = *allocationsAfter - *allocationsBefore;
+        report << "," << allocations;
+
+        if (warmUpFrames > 0) {
+          --warmUpFrames;
+        } else if (allocations > 0) {
+          if (allocatingFrames == 0) {
+            firstAllocatingFrame = frame;
+          }
+          ++allocatingFrames;
+        }
+      }
+
+      report << "\n";
+
+      ++frame;
+    } catch (std::exception const& e) {
+      logger().warn("Skipping invalid event in session recording '{}': {}", mFileName, e.what());
+    }
+  }
+
+  std::sort(totals.begin(), totals.end());
+
+  double sum = 0.0;
+  for (double total : totals) {
+    sum += total;
+  }
+
+  logger().info("Replayed {} frames. CPU time per frame in ms: mean {:.3f}, median {:.3f}, 95th "
+                "percentile {:.3f}, max {:.3f}. See '{}' for details.",
+      totals.size(), totals.empty() ? 0.0 : sum / static_cast<double>(totals.size()),
+      getPercentile(totals, 0.5), getPercentile(totals, 0.95),
+      totals.empty() ? 0.0 : totals.back(), mFileName + ".report.csv");
+
+  if (totals.empty()) {
+    logger().error("Session recording '{}' does not contain any valid frames!", mFileName);
+    return false;
+  }
+
+  // In the steady state, updating the objects must not allocate any memory.
+  if (countAllocations) {
+    if (allocatingFrames > 0) {
+      logger().error("Heap allocations in {} frames after the warm-up, the first one in frame {}!",
+          allocatingFrames, firstAllocatingFrame);
+      return false;
+    }
+
+    logger().info("No heap allocations after the warm-up.");
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
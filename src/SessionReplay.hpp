@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_SESSION_REPLAY_HPP
+#define CSP_TRAJECTORIES_SESSION_REPLAY_HPP
+
+#include <functional>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace csp::trajectories {
+
+class DeepSpaceDot;
+class SunFlare;
+class Trajectory;
+
+/// The SessionReplay feeds a recording of the SessionRecorder through the update logic of the
+/// plugin's Trajectories, DeepSpaceDots and SunFlares as fast as possible. Nothing is drawn during
+/// the replay. The CPU time spent in each frame is written to a CSV file next to the recording and
+/// a summary is printed to the log. Comparing these numbers between two builds reveals
+/// performance regressions.
+class SessionReplay {
+ public:
+  /// This is called for each recorded settings reload. It has to apply the given settings to the
+  /// plugin, which creates, reconfigures or removes the objects accordingly.
+  using SettingsCallback = std::function<void(nlohmann::json const&)>;
+
+  /// Reads the entire recording. Lines which cannot be parsed are skipped with a warning.
+  explicit SessionReplay(std::string const& fileName);
+
+  SessionReplay(SessionReplay const& other) = delete;
+  SessionReplay(SessionReplay&& other)      = delete;
+
+  SessionReplay& operator=(SessionReplay const& other) = delete;
+  SessionReplay& operator=(SessionReplay&& other) = delete;
+
+  ~SessionReplay() = default;
+
+  /// Replays all recorded frames. The maps are accessed by reference in each frame, so they may be
+  /// modified by the settings callback. Returns false if no frame could be replayed or if heap
+  /// allocations were counted in the updates after the warm-up. Drawing is not covered.
+  bool run(SettingsCallback const&                                            applySettings,
+      std::unordered_map<std::string, std::shared_ptr<Trajectory>> const&   trajectories,
+      std::unordered_map<std::string, std::shared_ptr<DeepSpaceDot>> const& dots,
+      std::unordered_map<std::string, std::shared_ptr<SunFlare>> const&     flares) const;
+
+ private:
+  std::string                 mFileName;
+  std::vector<nlohmann::json> mEvents;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_SESSION_REPLAY_HPP
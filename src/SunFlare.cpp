@@ -16,8 +16,12 @@
 #include <VistaKernel/VistaSystem.h>
 #include <VistaKernelOpenSGExt/VistaOpenSGMaterialTools.h>
 
+#include <algorithm>
+#include <cmath>
 #include <glm/gtc/type_ptr.hpp>
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace csp::trajectories {
 
@@ -107,6 +111,102 @@ void main()
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+const char* SunFlare::FAST_QUAD_VERT = R"(
+#version 330
+
+out vec2 vTexCoords;
+
+uniform float uAspect;
+uniform float uFarClip;
+uniform mat4 uMatModelView;
+uniform mat4 uMatProjection;
+
+void main()
+{
+    vec4 posVS = uMatModelView * vec4(0, 0, 0, 1);
+    float depth = length(posVS.xyz);
+
+    vec4 posP = uMatProjection * posVS;
+    float scale = length(uMatModelView[0]) / depth;
+
+    if (posP.w < 0) {
+        gl_Position = vec4(0);
+        return;
+    }
+
+    posP /= posP.w;
+
+    float h = scale * 10e10;
+    float w = h / uAspect;
+
+    // The depth is the same for all corners, so there is no need to write gl_FragDepth. Like
+    // gl_FragDepth in the other path, it is clamped so that distant suns are not clipped.
+    posP.z = min(2.0 * depth / uFarClip - 1.0, 0.999);
+
+    switch (gl_VertexID) {
+        case 0:
+            posP.xy += vec2(-w,  h);
+            vTexCoords = vec2(-1, 1);
+            break;
+        case 1:
+            posP.xy += vec2( w,  h);
+            vTexCoords = vec2(1, 1);
+            break;
+        case 2:
+            posP.xy += vec2(-w, -h);
+            vTexCoords = vec2(-1, -1);
+            break;
+        default:
+            posP.xy += vec2( w, -h);
+            vTexCoords = vec2(1, -1);
+            break;
+    }
+
+    gl_Position = posP;
+}
+)";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char* SunFlare::FAST_QUAD_FRAG = R"(
+#version 330
+
+uniform vec3 uCcolor;
+uniform sampler1D uGlowTexture;
+
+in vec2 vTexCoords;
+
+layout(location = 0) out vec3 oColor;
+
+void main()
+{
+    // The lookup texture is indexed by the fourth root of the distance. This gives more texels to
+    // the steep sun disc in the center.
+    float coord = pow(dot(vTexCoords, vTexCoords), 0.125);
+    oColor = uCcolor * texture(uGlowTexture, coord).r;
+}
+)";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const int GLOW_TEXTURE_SIZE = 1024;
+
+// The name of the frame timer. It is created once, so that drawing does not allocate memory.
+const std::string TIMER_NAME = "SunFlare";
+
+// This is the same glow profile as in SunFlare::QUAD_FRAG.
+float getGlow(double dist) {
+  double disc = std::exp(1.0 - dist * 100.0);
+  double glow = 1.0 - std::pow(std::min(1.0, dist), 0.05);
+  return static_cast<float>(disc + glow * 2.0);
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 SunFlare::SunFlare(std::shared_ptr<cs::core::Settings> settings,
     std::shared_ptr<Plugin::Settings> pluginSettings, std::string const& sCenterName,
     std::string const& sFrameName, double tStartExistence, double tEndExistence)
@@ -117,6 +217,10 @@ SunFlare::SunFlare(std::shared_ptr<cs::core::Settings> settings,
   mShader.InitFragmentShaderFromString(QUAD_FRAG);
   mShader.Link();
 
+  mFastShader.InitVertexShaderFromString(FAST_QUAD_VERT);
+  mFastShader.InitFragmentShaderFromString(FAST_QUAD_FRAG);
+  mFastShader.Link();
+
   // Add to scenegraph.
   VistaSceneGraph* pSG = GetVistaSystem()->GetGraphicsManager()->GetSceneGraph();
   mGLNode.reset(pSG->NewOpenGLNode(pSG->GetRoot(), this));
@@ -136,7 +240,7 @@ SunFlare::~SunFlare() {
 bool SunFlare::Do() {
   if (mPluginSettings->mEnableSunFlares.get() && getIsInExistence() &&
       !mSettings->mGraphics.pEnableHDR.get()) {
-    cs::utils::FrameTimings::ScopedTimer timer("SunFlare");
+    cs::utils::FrameTimings::ScopedTimer timer(TIMER_NAME);
     // get viewport to draw dot with correct aspect ration
     std::array<GLint, 4> viewport{};
     glGetIntegerv(GL_VIEWPORT, viewport.data());
@@ -153,6 +257,47 @@ bool SunFlare::Do() {
     glBlendFunc(GL_ONE, GL_ONE);
     glDepthMask(GL_FALSE);
 
+    if (mPluginSettings->mEnableFastSunFlares.get()) {
+      if (!mGlowTexture) {
+        std::vector<float> glow(GLOW_TEXTURE_SIZE);
+        for (int i = 0; i < GLOW_TEXTURE_SIZE; ++i) {
+          double coord = 1.0 * i / (GLOW_TEXTURE_SIZE - 1);
+          glow[i]      = getGlow(std::pow(coord, 4.0));
+        }
+
+        mGlowTexture = std::make_unique<VistaTexture>(GL_TEXTURE_1D);
+        mGlowTexture->Bind();
+        glTexImage1D(
+            GL_TEXTURE_1D, 0, GL_R16F, GLOW_TEXTURE_SIZE, 0, GL_RED, GL_FLOAT, glow.data());
+        mGlowTexture->SetWrapS(GL_CLAMP_TO_EDGE);
+        mGlowTexture->SetMinFilter(GL_LINEAR);
+        mGlowTexture->SetMagFilter(GL_LINEAR);
+        mGlowTexture->Unbind();
+      }
+
+      mFastShader.Bind();
+      glUniformMatrix4fv(
+          mFastShader.GetUniformLocation("uMatModelView"), 1, GL_FALSE, glm::value_ptr(matMV));
+      glUniformMatrix4fv(
+          mFastShader.GetUniformLocation("uMatProjection"), 1, GL_FALSE, glMatP.data());
+      mFastShader.SetUniform(mFastShader.GetUniformLocation("uCcolor"), pColor.get()[0],
+          pColor.get()[1], pColor.get()[2]);
+      mFastShader.SetUniform(mFastShader.GetUniformLocation("uAspect"), fAspect);
+      mFastShader.SetUniform(
+          mFastShader.GetUniformLocation("uFarClip"), cs::utils::getCurrentFarClipDistance());
+      mFastShader.SetUniform(mFastShader.GetUniformLocation("uGlowTexture"), 0);
+
+      mGlowTexture->Bind(GL_TEXTURE0);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+      mGlowTexture->Unbind(GL_TEXTURE0);
+      mFastShader.Release();
+
+      glDisable(GL_BLEND);
+      glDepthMask(GL_TRUE);
+
+      return true;
+    }
+
     // draw simple dot
     mShader.Bind();
     glUniformMatrix4fv(
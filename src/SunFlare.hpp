@@ -14,6 +14,7 @@
 #include <VistaBase/VistaColor.h>
 #include <VistaKernel/GraphicsManager/VistaOpenGLDraw.h>
 #include <VistaOGLExt/VistaGLSLShader.h>
+#include <VistaOGLExt/VistaTexture.h>
 #include <glm/glm.hpp>
 
 namespace cs::core {
@@ -25,6 +26,10 @@ namespace csp::trajectories {
 /// Adds an artificial flare effect around the object. Only makes sense for stars, but if you want
 /// you can make anything glow like a christmas light :D. The SunFlare is hidden when HDR rendering
 /// is enabled.
+///
+/// If fast sun flares are enabled, the radial glow profile is read from a precomputed lookup
+/// texture instead of being evaluated for each pixel. The glow has a long tail which is visible
+/// almost up to the border of the quad, so the quad has the same size in both paths.
 class SunFlare : public cs::scene::CelestialObject, public IVistaOpenGLDraw {
  public:
   /// The color of the flare.
@@ -52,9 +57,15 @@ class SunFlare : public cs::scene::CelestialObject, public IVistaOpenGLDraw {
   std::unique_ptr<VistaOpenGLNode> mGLNode;
 
   VistaGLSLShader mShader;
+  VistaGLSLShader mFastShader;
+
+  /// Created when the fast path is used for the first time.
+  std::unique_ptr<VistaTexture> mGlowTexture;
 
   static const char* QUAD_VERT;
   static const char* QUAD_FRAG;
+  static const char* FAST_QUAD_VERT;
+  static const char* FAST_QUAD_FRAG;
 };
 
 } // namespace csp::trajectories
@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "ThreadPool.hpp"
+
+#include "logger.hpp"
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool(size_t threadCount) {
+
+  // Queue zero belongs to the thread calling run().
+  for (size_t i = 0; i <= threadCount; ++i) {
+    mQueues.push_back(std::make_unique<Queue>());
+  }
+
+  for (size_t i = 1; i <= threadCount; ++i) {
+    mThreads.emplace_back([this, i]() { workerLoop(i); });
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mShutdown = true;
+  }
+
+  mWakeCondition.notify_all();
+
+  for (auto& thread : mThreads) {
+    thread.join();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t ThreadPool::getThreadCount() const {
+  return mThreads.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ThreadPool::run(std::vector<std::function<void()>> const& tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+
+  // Workers of the previous run may still be looking for tasks, so the counter has to be set
+  // before the first task is queued.
+  mRemainingTasks = tasks.size();
+
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    auto&                       queue = *mQueues[i % mQueues.size()];
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+    queue.mTasks.push_back(&tasks[i]);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mRunIndex;
+  }
+
+  mWakeCondition.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> lock(mMutex);
+  mDoneCondition.wait(lock, [this]() { return mRemainingTasks == 0; });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ThreadPool::workerLoop(size_t index) {
+  uint64_t lastRunIndex = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mWakeCondition.wait(lock, [&]() { return mShutdown || mRunIndex != lastRunIndex; });
+
+      if (mShutdown) {
+        return;
+      }
+
+      lastRunIndex = mRunIndex;
+    }
+
+    work(index);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ThreadPool::work(size_t index) {
+  while (auto const* task = popTask(index)) {
+    try {
+      (*task)();
+    } catch (std::exception const& e) {
+      logger().warn("Task of thread pool failed: {}", e.what());
+    }
+
+    // The mutex makes sure that run() cannot miss the notification between checking the counter
+    // and starting to wait.
+    if (--mRemainingTasks == 0) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mDoneCondition.notify_all();
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::function<void()> const* ThreadPool::popTask(size_t index) {
+
+  // First, take the oldest task of the own queue.
+  {
+    auto&                       queue = *mQueues[index];
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+
+    if (!queue.mTasks.empty()) {
+      auto const* task = queue.mTasks.front();
+      queue.mTasks.pop_front();
+      return task;
+    }
+  }
+
+  // Then, steal the newest task of another queue.
+  for (size_t i = 1; i < mQueues.size(); ++i) {
+    auto&                       queue = *mQueues[(index + i) % mQueues.size()];
+    std::lock_guard<std::mutex> lock(queue.mMutex);
+
+    if (!queue.mTasks.empty()) {
+      auto const* task = queue.mTasks.back();
+      queue.mTasks.pop_back();
+      return task;
+    }
+  }
+
+  return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_THREAD_POOL_HPP
+#define CSP_TRAJECTORIES_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace csp::trajectories {
+
+/// A small work-stealing thread pool. The tasks passed to run() are distributed evenly over one
+/// queue per thread. Each thread takes tasks from the front of its own queue and, once that is
+/// empty, steals tasks from the back of the other queues. This balances the load if some tasks
+/// take much longer than others, for example when a single trail has to be sampled from scratch.
+class ThreadPool {
+ public:
+  /// Starts the given number of worker threads. The thread calling run() works as well, so the
+  /// tasks are processed by threadCount + 1 threads.
+  explicit ThreadPool(size_t threadCount);
+
+  ThreadPool(ThreadPool const& other) = delete;
+  ThreadPool(ThreadPool&& other)      = delete;
+
+  ThreadPool& operator=(ThreadPool const& other) = delete;
+  ThreadPool& operator=(ThreadPool&& other) = delete;
+
+  ~ThreadPool();
+
+  size_t getThreadCount() const;
+
+  /// Processes all tasks and blocks until they are finished. Exceptions thrown by the tasks are
+  /// logged and ignored.
+  void run(std::vector<std::function<void()>> const& tasks);
+
+ private:
+  struct Queue {
+    std::mutex                                mMutex;
+    std::deque<std::function<void()> const*> mTasks;
+  };
+
+  void                          workerLoop(size_t index);
+  void                          work(size_t index);
+  std::function<void()> const* popTask(size_t index);
+
+  std::vector<std::thread>            mThreads;
+  std::vector<std::unique_ptr<Queue>> mQueues;
+
+  std::mutex              mMutex;
+  std::condition_variable mWakeCondition;
+  std::condition_variable mDoneCondition;
+  uint64_t                mRunIndex = 0;
+  bool                    mShutdown = false;
+  std::atomic<size_t>     mRemainingTasks{0};
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_THREAD_POOL_HPP
@@ -0,0 +1,305 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_TRAIL_BUFFER_HPP
+#define CSP_TRAJECTORIES_TRAIL_BUFFER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace csp::trajectories {
+
+/// The storage policies of the TrailBuffer. With DynamicCapacity, the buffer has exactly the
+/// requested capacity. With PowerOfTwoCapacity, the capacity is rounded up to the next power of two
+/// so that wrapping around is a bit mask. FixedCapacity<N> stores the samples in place. Its
+/// capacity is known at compile time and cannot be changed.
+struct DynamicCapacity {};
+struct PowerOfTwoCapacity {};
+template <size_t N>
+struct FixedCapacity {};
+
+namespace detail {
+
+template <typename T, typename Policy>
+class TrailBufferStorage;
+
+template <typename T>
+class TrailBufferStorage<T, DynamicCapacity> {
+ public:
+  using Container = std::vector<T>;
+
+  static size_t getSlotCount(size_t capacity) {
+    return capacity;
+  }
+
+  void resize(size_t capacity) {
+    mData.resize(capacity);
+  }
+
+  void release() {
+    Container().swap(mData);
+  }
+
+  /// Slots are never more than one capacity beyond the end, so a comparison replaces the modulo.
+  size_t wrap(size_t slot) const {
+    return slot >= mData.size() ? slot - mData.size() : slot;
+  }
+
+ protected:
+  Container mData;
+};
+
+template <typename T>
+class TrailBufferStorage<T, PowerOfTwoCapacity> {
+ public:
+  using Container = std::vector<T>;
+
+  static size_t getSlotCount(size_t capacity) {
+    size_t size = capacity > 0 ? 1 : 0;
+    while (size < capacity) {
+      size *= 2;
+    }
+
+    return size;
+  }
+
+  void resize(size_t capacity) {
+    size_t size = getSlotCount(capacity);
+    mData.resize(size);
+    mMask = size > 0 ? size - 1 : 0;
+  }
+
+  void release() {
+    Container().swap(mData);
+    mMask = 0;
+  }
+
+  size_t wrap(size_t slot) const {
+    return slot & mMask;
+  }
+
+ protected:
+  Container mData;
+  size_t    mMask = 0;
+};
+
+template <typename T, size_t N>
+class TrailBufferStorage<T, FixedCapacity<N>> {
+ public:
+  static_assert(N > 0, "A fixed-capacity TrailBuffer needs at least one slot!");
+
+  using Container = std::array<T, N>;
+
+  static size_t getSlotCount(size_t /*capacity*/) {
+    return N;
+  }
+
+  /// The capacity is fixed, so this does nothing.
+  void resize(size_t /*capacity*/) {
+  }
+
+  /// The samples are stored in place, so they can only be reset.
+  void release() {
+    mData.fill(T{});
+  }
+
+  /// As N is a compile-time constant, this is a bit mask if N is a power of two.
+  size_t wrap(size_t slot) const {
+    if constexpr ((N & (N - 1)) == 0) {
+      return slot & (N - 1);
+    } else {
+      return slot >= N ? slot - N : slot;
+    }
+  }
+
+ protected:
+  Container mData{};
+};
+
+} // namespace detail
+
+/// A ring buffer for the samples of a trail. All slots of the buffer are always in use, so the
+/// slot at getStart() contains the oldest sample and the slot before it the newest one. Slots which
+/// have not been written yet contain a default-constructed sample.
+///
+/// Slots are accessed directly with operator[]. There are no bounds checks and moving from one
+/// slot to the next never uses a modulo operation, so slots can be walked in chronological order
+/// with getSlot() or getNext() in hot loops. Consumers which need contiguous memory, for example
+/// for uploading the samples, can use getSpans() which returns the older and the newer samples as
+/// two spans.
+///
+/// Unlike std::vector::resize(), setCapacity() keeps the chronological order: the newest samples
+/// are kept and new slots are added before the oldest sample.
+///
+/// With FixedCapacity<N>, the number of slots never changes. clear() and release() only reset all
+/// slots to default-constructed samples, so size() stays N and empty() stays false.
+template <typename T, typename Policy = DynamicCapacity>
+class TrailBuffer : public detail::TrailBufferStorage<T, Policy> {
+ public:
+  using Storage   = detail::TrailBufferStorage<T, Policy>;
+  using Container = typename Storage::Container;
+
+  /// A contiguous range of samples.
+  struct Span {
+    T const* mData{};
+    size_t   mSize{};
+  };
+
+  size_t size() const {
+    return this->mData.size();
+  }
+
+  /// Returns true if there are no slots. This is never the case with FixedCapacity.
+  bool empty() const {
+    return this->mData.empty();
+  }
+
+  T& operator[](size_t slot) {
+    return this->mData[slot];
+  }
+
+  T const& operator[](size_t slot) const {
+    return this->mData[slot];
+  }
+
+  T* data() {
+    return this->mData.data();
+  }
+
+  T const* data() const {
+    return this->mData.data();
+  }
+
+  /// The underlying slots, for code which works with the ring buffer layout directly.
+  Container const& getSlots() const {
+    return this->mData;
+  }
+
+  /// The slot of the oldest sample. The next sample pushed to the back of the trail is written to
+  /// this slot.
+  size_t getStart() const {
+    return mStart;
+  }
+
+  /// Invalid slots are replaced by zero.
+  void setStart(size_t slot) {
+    mStart = slot < size() ? slot : 0;
+  }
+
+  /// Moves the start one slot forward, so the oldest sample becomes the newest one.
+  void advance() {
+    mStart = getNext(mStart);
+  }
+
+  /// Moves the start one slot backward, so the newest sample becomes the oldest one.
+  void rewind() {
+    mStart = getPrevious(mStart);
+  }
+
+  /// Returns the slot of the sample with the given chronological index. The index has to be
+  /// smaller than size().
+  size_t getSlot(size_t index) const {
+    return this->wrap(mStart + index);
+  }
+
+  size_t getNext(size_t slot) const {
+    return this->wrap(slot + 1);
+  }
+
+  size_t getPrevious(size_t slot) const {
+    return this->wrap(slot + size() - 1);
+  }
+
+  /// Writes the sample to the slot of the oldest sample, which then becomes the newest one.
+  /// Returns the slot.
+  size_t pushBack(T const& sample) {
+    size_t slot       = mStart;
+    this->mData[slot] = sample;
+    advance();
+    return slot;
+  }
+
+  /// Writes the sample to the slot of the newest sample, which then becomes the oldest one.
+  /// Returns the slot.
+  size_t pushFront(T const& sample) {
+    rewind();
+    this->mData[mStart] = sample;
+    return mStart;
+  }
+
+  /// The older samples from the start to the end of the slots followed by the newer samples from
+  /// the first slot up to the start.
+  std::pair<Span, Span> getSpans() const {
+    return {Span{data() + mStart, size() - mStart}, Span{data(), mStart}};
+  }
+
+  /// Changes the number of slots while keeping the newest samples in chronological order.
+  /// Afterwards, the oldest slot is the first one. The samples are moved in place, so this only
+  /// allocates memory if the number of slots grows.
+  void setCapacity(size_t capacity) {
+    size_t count = std::min(size(), Storage::getSlotCount(capacity));
+    auto   first = this->mData.begin();
+
+    // Move the newest samples to the front in chronological order, so that resizing keeps them.
+    if (!empty()) {
+      std::rotate(first, first + static_cast<std::ptrdiff_t>(getSlot(size() - count)),
+          this->mData.end());
+    }
+
+    Storage::resize(capacity);
+    first = this->mData.begin();
+
+    // Then move them to the back, all slots before them are reset.
+    auto last = first + static_cast<std::ptrdiff_t>(count);
+    std::fill(last, this->mData.end(), T{});
+    std::rotate(first, last, this->mData.end());
+
+    mStart = 0;
+  }
+
+  /// Replaces all slots with the given samples in chronological order. The previous slots are
+  /// returned in samples, so that their memory can be reused. The other policies have constraints
+  /// on the capacity, so this is only available with DynamicCapacity.
+  void swap(std::vector<T>& samples) {
+    static_assert(std::is_same_v<Policy, DynamicCapacity>, "Only dynamic buffers can be swapped!");
+
+    std::swap(this->mData, samples);
+    mStart = 0;
+  }
+
+  /// Removes all slots. With FixedCapacity, all slots are reset instead.
+  void clear() {
+    Storage::resize(0);
+    std::fill(this->mData.begin(), this->mData.end(), T{});
+    mStart = 0;
+  }
+
+  /// Removes all slots and frees their memory. With FixedCapacity, all slots are reset instead.
+  void release() {
+    Storage::release();
+    mStart = 0;
+  }
+
+  /// Returns the number of bytes allocated for the samples.
+  size_t getMemoryUsage() const {
+    if constexpr (std::is_same_v<Container, std::vector<T>>) {
+      return this->mData.capacity() * sizeof(T);
+    } else {
+      return sizeof(Container);
+    }
+  }
+
+ private:
+  size_t mStart = 0;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_TRAIL_BUFFER_HPP
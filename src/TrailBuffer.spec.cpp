@@ -0,0 +1,137 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "TrailBuffer.hpp"
+
+#include <doctest.h>
+#include <vector>
+
+namespace csp::trajectories {
+
+namespace {
+
+// Returns the samples of the buffer in chronological order, once with getSlot() and once with
+// getSpans(). Both have to be the same.
+template <typename Policy>
+std::vector<int> getSamples(TrailBuffer<int, Policy> const& buffer) {
+  std::vector<int> samples;
+  for (size_t i = 0; i < buffer.size(); ++i) {
+    samples.push_back(buffer[buffer.getSlot(i)]);
+  }
+
+  std::vector<int> spans;
+  auto [older, newer] = buffer.getSpans();
+  spans.insert(spans.end(), older.mData, older.mData + older.mSize);
+  spans.insert(spans.end(), newer.mData, newer.mData + newer.mSize);
+
+  CHECK(samples == spans);
+
+  return samples;
+}
+
+// Pushes, rewinds and resizes the given buffer, which has to have at least five slots.
+template <typename Policy>
+void checkPolicy(TrailBuffer<int, Policy>& buffer) {
+  for (int i = 1; i <= 8; ++i) {
+    buffer.pushBack(i);
+  }
+
+  size_t size = buffer.size();
+  REQUIRE(size >= 5);
+
+  // The newest samples are kept, the oldest one is at the start.
+  auto samples = getSamples(buffer);
+  CHECK(samples.back() == 8);
+  CHECK(buffer[buffer.getPrevious(buffer.getStart())] == 8);
+
+  // Rewinding makes the newest sample the oldest one.
+  buffer.rewind();
+  CHECK(buffer[buffer.getStart()] == 8);
+  buffer.advance();
+
+  // pushFront() overwrites the newest sample, pushBack() then overwrites it again.
+  buffer.pushFront(0);
+  CHECK(getSamples(buffer).front() == 0);
+  buffer.pushBack(9);
+  CHECK(getSamples(buffer).back() == 9);
+
+  // Shrinking keeps the newest samples.
+  buffer.setCapacity(4);
+  samples = getSamples(buffer);
+  CHECK(buffer.getStart() == 0);
+  CHECK(samples.size() == buffer.size());
+  CHECK(samples.back() == 9);
+  CHECK(samples[samples.size() - 2] == 7);
+
+  // Growing adds default-constructed samples before the oldest one.
+  size_t before = buffer.size();
+  buffer.setCapacity(size * 2);
+  samples = getSamples(buffer);
+  CHECK(buffer.getStart() == 0);
+  CHECK(samples.back() == 9);
+  CHECK(samples[samples.size() - 2] == 7);
+  if (buffer.size() > before) {
+    CHECK(samples.front() == 0);
+  }
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("csp::trajectories::TrailBuffer<DynamicCapacity>") {
+  TrailBuffer<int, DynamicCapacity> buffer;
+  buffer.setCapacity(5);
+  CHECK(buffer.size() == 5);
+
+  checkPolicy(buffer);
+  CHECK(buffer.size() == 10);
+
+  buffer.clear();
+  CHECK(buffer.empty());
+  CHECK(buffer.size() == 0);
+
+  // Swapping replaces all slots.
+  std::vector<int> samples{1, 2, 3};
+  buffer.swap(samples);
+  CHECK(buffer.size() == 3);
+  CHECK(getSamples(buffer) == std::vector<int>{1, 2, 3});
+}
+
+TEST_CASE("csp::trajectories::TrailBuffer<PowerOfTwoCapacity>") {
+  TrailBuffer<int, PowerOfTwoCapacity> buffer;
+  buffer.setCapacity(5);
+  CHECK(buffer.size() == 8);
+
+  checkPolicy(buffer);
+  CHECK(buffer.size() == 16);
+
+  // Wrapping around uses a bit mask.
+  CHECK(buffer.getNext(15) == 0);
+  CHECK(buffer.getPrevious(0) == 15);
+
+  buffer.clear();
+  CHECK(buffer.empty());
+}
+
+TEST_CASE("csp::trajectories::TrailBuffer<FixedCapacity>") {
+  TrailBuffer<int, FixedCapacity<6>> buffer;
+  CHECK(buffer.size() == 6);
+
+  checkPolicy(buffer);
+  CHECK(buffer.size() == 6);
+
+  // The number of slots of a fixed buffer never changes, clear() only resets them.
+  buffer.clear();
+  CHECK(!buffer.empty());
+  CHECK(buffer.size() == 6);
+  CHECK(buffer.getStart() == 0);
+  CHECK(getSamples(buffer) == std::vector<int>(6, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
@@ -0,0 +1,369 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "TrailCache.hpp"
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cspice/SpiceUsr.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+constexpr std::array<char, 8> FILE_MAGIC   = {'C', 'S', 'P', 'T', 'R', 'A', 'I', 'L'};
+constexpr uint32_t            FILE_VERSION = 1;
+
+// 64 bit FNV-1a hash. This is used for file names, the kernel fingerprint and the checksum.
+uint64_t hash(void const* data, size_t size, uint64_t seed = 14695981039346656037ULL) {
+  auto const* bytes = static_cast<uint8_t const*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    seed = (seed ^ bytes[i]) * 1099511628211ULL;
+  }
+  return seed;
+}
+
+std::string toHex(uint64_t value) {
+  std::ostringstream stream;
+  stream << std::hex << value;
+  return stream.str();
+}
+
+// The samples are stored component-wise. Each value is stored as the difference of its bit
+// pattern to the bit pattern of the previous value. As consecutive samples are close to each
+// other, these differences are small and can be stored in a few bytes using a zig-zag variable
+// length encoding. In contrast to storing floating point differences, this is lossless.
+void writeVarint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+bool readVarint(uint8_t const*& data, uint8_t const* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && data != end; shift += 7) {
+    uint8_t byte = *data++;
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<uint8_t> encode(std::vector<glm::dvec4> const& samples) {
+  std::vector<uint8_t> result;
+  result.reserve(samples.size() * 4 * 4);
+
+  for (int c = 0; c < 4; ++c) {
+    uint64_t previous = 0;
+    for (auto const& sample : samples) {
+      uint64_t bits{};
+      std::memcpy(&bits, &sample[c], sizeof(bits));
+      auto delta = static_cast<int64_t>(bits - previous);
+      writeVarint(result, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+      previous = bits;
+    }
+  }
+
+  return result;
+}
+
+bool decode(std::vector<uint8_t> const& data, std::vector<glm::dvec4>& samples) {
+  uint8_t const* current = data.data();
+  uint8_t const* end     = data.data() + data.size();
+
+  for (int c = 0; c < 4; ++c) {
+    uint64_t previous = 0;
+    for (auto& sample : samples) {
+      uint64_t zigzag{};
+      if (!readVarint(current, end, zigzag)) {
+        return false;
+      }
+      uint64_t delta = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+      uint64_t bits  = previous + delta;
+      std::memcpy(&sample[c], &bits, sizeof(bits));
+      previous = bits;
+    }
+  }
+
+  return current == end;
+}
+
+template <typename T>
+void writeValue(std::ofstream& stream, T const& value) {
+  stream.write(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::ifstream& stream, T& value) {
+  return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string TrailCache::Key::toString() const {
+  std::ostringstream stream;
+  stream << mTargetCenter << "|" << mTargetFrame << "|" << mParentCenter << "|" << mParentFrame
+         << "|" << mSamples << "|" << std::hexfloat << mLength << "|" << mStartExistence << "|"
+         << mEndExistence << "|" << mHasVelocities << "|" << mIsAligned << "|" << mDetailLevels;
+  return stream.str();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TrailCache::TrailCache(std::string directory, uint64_t sizeLimit)
+    : mDirectory(std::move(directory))
+    , mSizeLimit(sizeLimit)
+    , mKernelFingerprint(computeKernelFingerprint()) {
+
+  std::error_code error;
+  std::filesystem::create_directories(mDirectory, error);
+
+  if (error) {
+    logger().warn("Failed to create trail cache directory '{}': {}", mDirectory, error.message());
+    return;
+  }
+
+  prune();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string const& TrailCache::getDirectory() const {
+  return mDirectory;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t TrailCache::getSizeLimit() const {
+  return mSizeLimit;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::future<std::vector<glm::dvec4>> TrailCache::loadAsync(Key const& key) const {
+  std::string keyString = key.toString() + "|" + mKernelFingerprint;
+  std::string fileName  = getFileName(keyString);
+
+  return std::async(std::launch::async,
+      [fileName = std::move(fileName), keyString = std::move(keyString),
+          samples = key.mSamples]() { return load(fileName, keyString, samples); });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrailCache::save(Key const& key, std::vector<glm::dvec4> const& samples) const {
+  std::string keyString = key.toString() + "|" + mKernelFingerprint;
+  std::string fileName  = getFileName(keyString);
+
+  auto payload = encode(samples);
+
+  // Write to a temporary file first, so that an interrupted write does not leave a broken file.
+  std::ofstream stream(fileName + ".tmp", std::ios::binary | std::ios::trunc);
+  stream.write(FILE_MAGIC.data(), FILE_MAGIC.size());
+  writeValue(stream, FILE_VERSION);
+  writeValue(stream, static_cast<uint32_t>(keyString.size()));
+  stream.write(keyString.data(), static_cast<std::streamsize>(keyString.size()));
+  writeValue(stream, static_cast<uint32_t>(samples.size()));
+  writeValue(stream, static_cast<uint64_t>(payload.size()));
+  writeValue(stream, hash(payload.data(), payload.size()));
+  stream.write(reinterpret_cast<char const*>(payload.data()),
+      static_cast<std::streamsize>(payload.size()));
+  stream.close();
+
+  std::error_code error;
+  if (stream.fail()) {
+    std::filesystem::remove(fileName + ".tmp", error);
+    logger().warn("Failed to write trail cache file '{}'!", fileName);
+    return;
+  }
+
+  std::filesystem::rename(fileName + ".tmp", fileName, error);
+
+  if (error) {
+    logger().warn("Failed to write trail cache file '{}': {}", fileName, error.message());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string TrailCache::getFileName(std::string const& key) const {
+  return mDirectory + "/" + toHex(hash(key.data(), key.size())) + ".trail";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrailCache::prune() const {
+  struct File {
+    std::filesystem::path           mPath;
+    uint64_t                        mSize;
+    std::filesystem::file_time_type mLastUse;
+  };
+
+  std::vector<File> files;
+  std::error_code   error;
+
+  for (auto const& entry : std::filesystem::directory_iterator(mDirectory, error)) {
+    if (!entry.is_regular_file(error)) {
+      continue;
+    }
+
+    // Temporary files are only left over if a session was interrupted while saving.
+    if (entry.path().extension() == ".tmp") {
+      std::filesystem::remove(entry.path(), error);
+    } else if (entry.path().extension() == ".trail") {
+      files.push_back({entry.path(), entry.file_size(error), entry.last_write_time(error)});
+    }
+  }
+
+  // Loaded files are touched, so the modification time is the time of their last use.
+  std::sort(files.begin(), files.end(),
+      [](File const& a, File const& b) { return a.mLastUse > b.mLastUse; });
+
+  uint64_t totalSize = 0;
+  size_t   removed   = 0;
+
+  for (auto const& file : files) {
+    totalSize += file.mSize;
+
+    if (totalSize > mSizeLimit) {
+      std::filesystem::remove(file.mPath, error);
+      ++removed;
+    }
+  }
+
+  if (removed > 0) {
+    logger().debug("Removed {} trail cache files to stay below the size limit.", removed);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::vector<glm::dvec4> TrailCache::load(
+    std::string const& fileName, std::string const& key, uint32_t expectedSamples) {
+
+  // This runs on a background thread. Exceptions would be rethrown when the result is retrieved
+  // in the main thread, so anything unexpected is treated like a missing cache entry.
+  try {
+    std::ifstream stream(fileName, std::ios::binary);
+
+    if (!stream) {
+      return {};
+    }
+
+    std::array<char, 8> magic{};
+    uint32_t            version{};
+    uint32_t            keyLength{};
+
+    if (!stream.read(magic.data(), magic.size()) || magic != FILE_MAGIC ||
+        !readValue(stream, version) || version != FILE_VERSION || !readValue(stream, keyLength) ||
+        keyLength != key.size()) {
+      logger().debug("Ignoring incompatible trail cache file '{}'.", fileName);
+      return {};
+    }
+
+    std::string storedKey(keyLength, '\0');
+    uint32_t    sampleCount{};
+    uint64_t    payloadSize{};
+    uint64_t    checksum{};
+
+    if (!stream.read(storedKey.data(), keyLength) || storedKey != key ||
+        !readValue(stream, sampleCount) || !readValue(stream, payloadSize) ||
+        !readValue(stream, checksum)) {
+      logger().debug("Ignoring incompatible trail cache file '{}'.", fileName);
+      return {};
+    }
+
+    // The header is not covered by the checksum, so the sizes are checked before anything is
+    // allocated.
+    auto fileSize = std::filesystem::file_size(fileName);
+    auto position = static_cast<uint64_t>(stream.tellg());
+
+    if (sampleCount != expectedSamples || position > fileSize ||
+        payloadSize > fileSize - position) {
+      logger().warn("Ignoring corrupt trail cache file '{}'!", fileName);
+      return {};
+    }
+
+    std::vector<uint8_t> payload(payloadSize);
+    if (!stream.read(reinterpret_cast<char*>(payload.data()),
+            static_cast<std::streamsize>(payloadSize)) ||
+        hash(payload.data(), payload.size()) != checksum) {
+      logger().warn("Ignoring corrupt trail cache file '{}'!", fileName);
+      return {};
+    }
+
+    std::vector<glm::dvec4> samples(sampleCount);
+    if (!decode(payload, samples)) {
+      logger().warn("Ignoring corrupt trail cache file '{}'!", fileName);
+      return {};
+    }
+
+    // Mark the file as recently used, so that it is kept when the cache is pruned.
+    stream.close();
+    std::error_code error;
+    std::filesystem::last_write_time(
+        fileName, std::filesystem::file_time_type::clock::now(), error);
+
+    return samples;
+  } catch (std::exception const& e) {
+    logger().warn("Failed to read trail cache file '{}': {}", fileName, e.what());
+    return {};
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string TrailCache::computeKernelFingerprint() {
+  SpiceInt count = 0;
+  ktotal_c("ALL", &count);
+
+  uint64_t fingerprint = hash(nullptr, 0);
+
+  for (SpiceInt i = 0; i < count; ++i) {
+    std::array<SpiceChar, 512> file{};
+    std::array<SpiceChar, 32>  type{};
+    std::array<SpiceChar, 512> source{};
+    SpiceInt                   handle{};
+    SpiceBoolean               found{};
+
+    kdata_c(i, "ALL", file.size(), type.size(), source.size(), file.data(), type.data(),
+        source.data(), &handle, &found);
+
+    if (!found) {
+      continue;
+    }
+
+    // The file name together with its size and modification time identifies a kernel well
+    // enough. Hashing the contents of all kernels would take far too long.
+    std::error_code error;
+    auto            size = std::filesystem::file_size(file.data(), error);
+    auto time = std::filesystem::last_write_time(file.data(), error).time_since_epoch().count();
+
+    fingerprint = hash(file.data(), std::strlen(file.data()), fingerprint);
+    fingerprint = hash(&size, sizeof(size), fingerprint);
+    fingerprint = hash(&time, sizeof(time), fingerprint);
+  }
+
+  return toHex(fingerprint);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
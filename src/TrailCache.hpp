@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_TRAIL_CACHE_HPP
+#define CSP_TRAJECTORIES_TRAIL_CACHE_HPP
+
+#include <glm/glm.hpp>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace csp::trajectories {
+
+/// The TrailCache stores sampled trails on disk so that they can be shown at full resolution right
+/// away in the next session. Each trail is stored in a separate file whose name is derived from
+/// the trail's configuration and a fingerprint of the loaded SPICE kernels. The samples are
+/// delta-encoded and validated with a checksum when they are loaded. If the files in the cache
+/// directory exceed the given size limit, the least recently used ones are deleted.
+class TrailCache {
+ public:
+  /// Everything which influences the samples of a trail.
+  struct Key {
+    std::string mTargetCenter;
+    std::string mTargetFrame;
+    std::string mParentCenter;
+    std::string mParentFrame;
+    uint32_t    mSamples{};
+    double      mLength{};
+    double      mStartExistence{};
+    double      mEndExistence{};
+    bool        mHasVelocities{};
+    bool        mIsAligned{};
+    int32_t     mDetailLevels{};
+
+    /// A unique string representation of the key. This is also stored in the cache files.
+    std::string toString() const;
+  };
+
+  /// The given directory is created if it does not exist yet. The kernel fingerprint is computed
+  /// once in the constructor, so the cache should be created after all kernels have been loaded.
+  /// The directory is pruned to the given size in bytes in the constructor as well.
+  TrailCache(std::string directory, uint64_t sizeLimit);
+
+  TrailCache(TrailCache const& other) = delete;
+  TrailCache(TrailCache&& other)      = delete;
+
+  TrailCache& operator=(TrailCache const& other) = delete;
+  TrailCache& operator=(TrailCache&& other) = delete;
+
+  ~TrailCache() = default;
+
+  std::string const& getDirectory() const;
+  uint64_t           getSizeLimit() const;
+
+  /// Loads the samples for the given key on a background thread. The samples are returned in
+  /// chronological order. If there is no valid cache entry, the returned vector is empty.
+  std::future<std::vector<glm::dvec4>> loadAsync(Key const& key) const;
+
+  /// Writes the given samples to the cache directory. The samples have to be in chronological
+  /// order.
+  void save(Key const& key, std::vector<glm::dvec4> const& samples) const;
+
+ private:
+  std::string getFileName(std::string const& key) const;
+
+  /// Deletes left-over temporary files and the least recently used cache files until the
+  /// remaining ones fit into mSizeLimit.
+  void prune() const;
+
+  static std::vector<glm::dvec4> load(
+      std::string const& fileName, std::string const& key, uint32_t expectedSamples);
+  static std::string             computeKernelFingerprint();
+
+  std::string mDirectory;
+  uint64_t    mSizeLimit;
+  std::string mKernelFingerprint;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_TRAIL_CACHE_HPP
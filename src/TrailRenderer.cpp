@@ -0,0 +1,359 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "TrailRenderer.hpp"
+
+#include "../../../src/cs-utils/utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <glm/gtc/type_ptr.hpp>
+#include <numeric>
+
+namespace csp::trajectories {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char* TrailRenderer::VERT = R"(
+#version 330
+
+layout(location = 0) in vec3 iPositionHigh;
+layout(location = 1) in vec3 iPositionLow;
+layout(location = 2) in float iTime;
+
+uniform mat4 uMatModelView;
+uniform mat4 uMatProjection;
+uniform vec3 uEyeHigh;
+uniform vec3 uEyeLow;
+uniform float uTime;
+uniform float uMaxAge;
+uniform float uPeriod;
+uniform vec4 uStartColor;
+uniform vec4 uEndColor;
+
+uniform bool uDrawTip;
+uniform vec3 uTipPositions[2];
+uniform float uTipTimes[2];
+
+out vec4 vColor;
+out float vDepth;
+
+void main()
+{
+    vec3 position;
+    float time;
+
+    if (uDrawTip) {
+        position = uTipPositions[gl_VertexID];
+        time     = uTipTimes[gl_VertexID];
+    } else {
+        // The large parts cancel out before the small parts are added.
+        vec3 high = iPositionHigh - uEyeHigh;
+        vec3 low  = iPositionLow - uEyeLow;
+        position  = high + low;
+        time      = iTime;
+    }
+
+    float age = uTime - time;
+
+    if (uPeriod > 0.0) {
+        age = mod(age, uPeriod);
+    }
+
+    age /= uMaxAge;
+    vColor    = mix(uStartColor, uEndColor, clamp(age, 0.0, 1.0));
+
+    if (age > 1.0) {
+        vColor.a = 0.0;
+    }
+
+    vec4 pos    = uMatModelView * vec4(position, 1.0);
+    vDepth      = length(pos.xyz);
+    gl_Position = uMatProjection * pos;
+}
+)";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char* TrailRenderer::FRAG = R"(
+#version 330
+
+uniform float uFarClip;
+
+in vec4 vColor;
+in float vDepth;
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+    oColor       = vColor;
+    gl_FragDepth = vDepth / uFarClip;
+}
+)";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Each sample consists of the high and the low part of its position and its time.
+const int FLOATS_PER_VERTEX = 7;
+
+// If the time changes by more than this since the last complete upload, all samples are uploaded
+// again to keep enough precision for the float time values.
+const double MAX_TIME_OFFSET = 1.0e6;
+
+void split(glm::dvec3 const& value, glm::vec3& high, glm::vec3& low) {
+  high = glm::vec3(value);
+  low  = glm::vec3(value - glm::dvec3(high));
+}
+
+// Returns the shader which is shared by all renderers. It is compiled when the first renderer is
+// created and deleted together with the last one.
+std::shared_ptr<VistaGLSLShader> getSharedShader(const char* vert, const char* frag) {
+  static std::weak_ptr<VistaGLSLShader> sharedShader;
+
+  auto shader = sharedShader.lock();
+  if (!shader) {
+    shader = std::make_shared<VistaGLSLShader>();
+    shader->InitVertexShaderFromString(vert);
+    shader->InitFragmentShaderFromString(frag);
+    shader->Link();
+    sharedShader = shader;
+  }
+
+  return shader;
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TrailRenderer::TrailRenderer()
+    : mShader(getSharedShader(VERT, FRAG)) {
+
+  GLsizei stride = FLOATS_PER_VERTEX * sizeof(float);
+
+  mVAO.EnableAttributeArray(0);
+  mVAO.SpecifyAttributeArrayFloat(0, 3, GL_FLOAT, GL_FALSE, stride, 0, &mVBO);
+  mVAO.EnableAttributeArray(1);
+  mVAO.SpecifyAttributeArrayFloat(1, 3, GL_FLOAT, GL_FALSE, stride, 3 * sizeof(float), &mVBO);
+  mVAO.EnableAttributeArray(2);
+  mVAO.SpecifyAttributeArrayFloat(2, 1, GL_FLOAT, GL_FALSE, stride, 6 * sizeof(float), &mVBO);
+  mVAO.SpecifyIndexBufferObject(&mIBO, GL_UNSIGNED_INT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrailRenderer::invalidate(size_t slot) {
+  if (mUploadAll) {
+    return;
+  }
+
+  // Uploading everything at once is cheaper than many small uploads. This also limits the size of
+  // mDirtySlots if update() is not called for a while.
+  if (mDirtySlots.size() >= std::max<size_t>(mCount / 4, 1)) {
+    invalidateAll();
+    return;
+  }
+
+  mDirtySlots.push_back(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrailRenderer::invalidateAll() {
+  mUploadAll = true;
+  mDirtySlots.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrailRenderer::setPeriod(double period) {
+  if (period != mPeriod) {
+    mPeriod = period;
+    invalidateAll();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrailRenderer::update(std::vector<glm::dvec4> const& points, int startIndex,
+    glm::dvec3 const& tip, double tTime) {
+
+  // For periodic trails, the time is reduced modulo the period when drawing, so it never drifts
+  // away from the time origin.
+  bool timeOriginIsFar = mPeriod <= 0.0 && std::abs(tTime - mTimeOrigin) > MAX_TIME_OFFSET;
+
+  if (points.size() != mCount || timeOriginIsFar) {
+    mUploadAll = true;
+  }
+
+  mCount      = points.size();
+  mStartIndex = startIndex;
+  mTip        = tip;
+  mTime       = tTime;
+
+  if (mCount < 2) {
+    return;
+  }
+
+  mNewest = points[(mStartIndex + mCount - 1) % mCount];
+
+  auto writeVertex = [this, &points](size_t slot, float* vertex) {
+    glm::vec3 high;
+    glm::vec3 low;
+    split(glm::dvec3(points[slot]), high, low);
+
+    vertex[0] = high.x;
+    vertex[1] = high.y;
+    vertex[2] = high.z;
+    vertex[3] = low.x;
+    vertex[4] = low.y;
+    vertex[5] = low.z;
+    vertex[6] = static_cast<float>(points[slot].w - mTimeOrigin);
+  };
+
+  if (mUploadAll) {
+    mTimeOrigin = tTime;
+
+    mVertices.resize(mCount * FLOATS_PER_VERTEX);
+    for (size_t i = 0; i < mCount; ++i) {
+      writeVertex(i, &mVertices[i * FLOATS_PER_VERTEX]);
+    }
+
+    mVBO.Bind(GL_ARRAY_BUFFER);
+    mVBO.BufferData(static_cast<GLsizeiptr>(mVertices.size() * sizeof(float)), mVertices.data(),
+        GL_DYNAMIC_DRAW);
+    mVBO.Release();
+
+    // The indices contain the ring buffer twice, so that the samples in chronological order can be
+    // drawn with a single line strip starting at the start index. They only depend on the number
+    // of samples.
+    if (mIndices.size() != 2 * mCount) {
+      mIndices.resize(2 * mCount);
+      std::iota(mIndices.begin(), mIndices.begin() + static_cast<std::ptrdiff_t>(mCount), 0U);
+      std::iota(mIndices.begin() + static_cast<std::ptrdiff_t>(mCount), mIndices.end(), 0U);
+
+      mIBO.Bind(GL_ELEMENT_ARRAY_BUFFER);
+      mIBO.BufferData(static_cast<GLsizeiptr>(mIndices.size() * sizeof(GLuint)), mIndices.data(),
+          GL_STATIC_DRAW);
+      mIBO.Release();
+    }
+
+    mGPUBytes = mVertices.size() * sizeof(float) + mIndices.size() * sizeof(GLuint);
+
+    mUploadAll = false;
+    mDirtySlots.clear();
+    return;
+  }
+
+  if (mDirtySlots.empty()) {
+    return;
+  }
+
+  std::array<float, FLOATS_PER_VERTEX> vertex{};
+
+  mVBO.Bind(GL_ARRAY_BUFFER);
+
+  for (size_t slot : mDirtySlots) {
+    if (slot < mCount) {
+      writeVertex(slot, vertex.data());
+      mVBO.BufferSubData(static_cast<GLintptr>(slot * sizeof(vertex)), sizeof(vertex),
+          vertex.data());
+    }
+  }
+
+  mVBO.Release();
+  mDirtySlots.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t TrailRenderer::getMemoryUsage() const {
+  return mVertices.capacity() * sizeof(float) + mIndices.capacity() * sizeof(GLuint) +
+         mDirtySlots.capacity() * sizeof(size_t) + mGPUBytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TrailRenderer::draw(glm::dmat4 const& matWorldTransform, glm::vec4 const& startColor,
+    glm::vec4 const& endColor, double maxAge, float width) {
+
+  if (mCount < 2) {
+    return;
+  }
+
+  std::array<GLfloat, 16> glMatV{};
+  std::array<GLfloat, 16> glMatP{};
+  glGetFloatv(GL_MODELVIEW_MATRIX, glMatV.data());
+  glGetFloatv(GL_PROJECTION_MATRIX, glMatP.data());
+
+  // The world transform is split into the position of the eye in the parent's coordinate system
+  // and the remaining rotation and scale.
+  glm::dvec3 eye = glm::dvec3(glm::inverse(matWorldTransform) * glm::dvec4(0.0, 0.0, 0.0, 1.0));
+  glm::dmat4 matRotationScale = glm::dmat4(glm::dmat3(matWorldTransform));
+  glm::mat4  matMV =
+      glm::make_mat4x4(glMatV.data()) * glm::mat4(matRotationScale);
+
+  glm::vec3 eyeHigh;
+  glm::vec3 eyeLow;
+  split(eye, eyeHigh, eyeLow);
+
+  // The tip segment is computed relative to the eye in double precision.
+  std::array<glm::vec3, 2> tipPositions = {
+      glm::vec3(glm::dvec3(mNewest) - eye), glm::vec3(mTip - eye)};
+  double time = mTime - mTimeOrigin;
+  if (mPeriod > 0.0) {
+    time -= mPeriod * std::floor(time / mPeriod);
+  }
+
+  std::array<float, 2> tipTimes = {
+      static_cast<float>(mNewest.w - mTimeOrigin), static_cast<float>(time)};
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glDepthMask(GL_FALSE);
+  glLineWidth(width);
+
+  mShader->Bind();
+  glUniformMatrix4fv(
+      mShader->GetUniformLocation("uMatModelView"), 1, GL_FALSE, glm::value_ptr(matMV));
+  glUniformMatrix4fv(mShader->GetUniformLocation("uMatProjection"), 1, GL_FALSE, glMatP.data());
+  glUniform3fv(mShader->GetUniformLocation("uEyeHigh"), 1, glm::value_ptr(eyeHigh));
+  glUniform3fv(mShader->GetUniformLocation("uEyeLow"), 1, glm::value_ptr(eyeLow));
+  glUniform4fv(mShader->GetUniformLocation("uStartColor"), 1, glm::value_ptr(startColor));
+  glUniform4fv(mShader->GetUniformLocation("uEndColor"), 1, glm::value_ptr(endColor));
+  mShader->SetUniform(mShader->GetUniformLocation("uTime"), static_cast<float>(time));
+  mShader->SetUniform(mShader->GetUniformLocation("uMaxAge"), static_cast<float>(maxAge));
+  mShader->SetUniform(mShader->GetUniformLocation("uPeriod"), static_cast<float>(mPeriod));
+  mShader->SetUniform(
+      mShader->GetUniformLocation("uFarClip"), cs::utils::getCurrentFarClipDistance());
+
+  mVAO.Bind();
+
+  mShader->SetUniform(mShader->GetUniformLocation("uDrawTip"), 0);
+  glDrawElements(GL_LINE_STRIP, static_cast<GLsizei>(mCount), GL_UNSIGNED_INT,
+      reinterpret_cast<void*>(mStartIndex * sizeof(GLuint))); // NOLINT(performance-no-int-to-ptr)
+
+  mShader->SetUniform(mShader->GetUniformLocation("uDrawTip"), 1);
+  glUniform3fv(mShader->GetUniformLocation("uTipPositions"), 2,
+      glm::value_ptr(tipPositions[0]));
+  glUniform1fv(mShader->GetUniformLocation("uTipTimes"), 2, tipTimes.data());
+  glDrawArrays(GL_LINES, 0, 2);
+
+  mVAO.Release();
+  mShader->Release();
+
+  glLineWidth(1.F);
+  glDepthMask(GL_TRUE);
+  glDisable(GL_BLEND);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace csp::trajectories
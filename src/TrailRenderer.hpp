@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSP_TRAJECTORIES_TRAIL_RENDERER_HPP
+#define CSP_TRAJECTORIES_TRAIL_RENDERER_HPP
+
+#include <VistaOGLExt/VistaBufferObject.h>
+#include <VistaOGLExt/VistaGLSLShader.h>
+#include <VistaOGLExt/VistaVertexArrayObject.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+namespace csp::trajectories {
+
+/// The TrailRenderer keeps the samples of a trail on the GPU in the coordinate system of the
+/// trail's parent. The GPU buffer mirrors the ring buffer of the Trajectory: only samples which
+/// changed are uploaded again. The transformation to the observer is done in the vertex shader
+/// using relative-to-eye coordinates: each position is stored as the sum of a high and a low float
+/// part, and the eye position is subtracted from both parts separately before they are added. This
+/// keeps full precision close to the observer. Hence, if only the observer moves, drawing the
+/// trail costs a few uniform updates only.
+///
+/// The segment from the newest sample to the current position of the target is drawn from
+/// uniforms as well. The shader is shared by all instances, each instance only owns its buffers.
+class TrailRenderer {
+ public:
+  TrailRenderer();
+
+  TrailRenderer(TrailRenderer const& other) = delete;
+  TrailRenderer(TrailRenderer&& other)      = delete;
+
+  TrailRenderer& operator=(TrailRenderer const& other) = delete;
+  TrailRenderer& operator=(TrailRenderer&& other) = delete;
+
+  ~TrailRenderer() = default;
+
+  /// Marks the given ring-buffer slot for upload.
+  void invalidate(size_t slot);
+
+  /// Uploads all samples on the next call to update().
+  void invalidateAll();
+
+  /// If the period is larger than zero, the samples form a closed loop which is traversed once in
+  /// this time. The age of each sample is then computed modulo the period, so the fading trail
+  /// moves along the loop without any upload.
+  void setPeriod(double period);
+
+  /// Uploads all invalidated samples. The samples are positions relative to the trail's parent
+  /// together with their time. The tip is the current position of the target.
+  void update(std::vector<glm::dvec4> const& points, int startIndex, glm::dvec3 const& tip,
+      double tTime);
+
+  /// Returns the number of bytes allocated for the samples on the host and on the GPU.
+  size_t getMemoryUsage() const;
+
+  /// Draws the trail. The given matrix transforms from the parent's coordinate system to world
+  /// space. All samples older than maxAge are fully transparent.
+  void draw(glm::dmat4 const& matWorldTransform, glm::vec4 const& startColor,
+      glm::vec4 const& endColor, double maxAge, float width);
+
+ private:
+  std::shared_ptr<VistaGLSLShader> mShader;
+
+  VistaBufferObject      mVBO;
+  VistaBufferObject      mIBO;
+  VistaVertexArrayObject mVAO;
+
+  std::vector<float>  mVertices;
+  std::vector<GLuint> mIndices;
+  std::vector<size_t> mDirtySlots;
+  bool                mUploadAll = true;
+
+  size_t     mCount      = 0;
+  size_t     mGPUBytes   = 0;
+  int        mStartIndex = 0;
+  glm::dvec4 mNewest{};
+  glm::dvec3 mTip{};
+  double     mTime{};
+  double     mPeriod{};
+
+  /// Times are stored as floats relative to this time. It is reset whenever all samples are
+  /// uploaded.
+  double mTimeOrigin{};
+
+  static const char* VERT;
+  static const char* FRAG;
+};
+
+} // namespace csp::trajectories
+
+#endif // CSP_TRAJECTORIES_TRAIL_RENDERER_HPP
@@ -10,16 +10,55 @@
 #include "../../../src/cs-utils/FrameTimings.hpp"
 #include "logger.hpp"
 
+#include <GL/glew.h>
 #include <VistaKernel/GraphicsManager/VistaGraphicsManager.h>
 #include <VistaKernel/GraphicsManager/VistaSceneGraph.h>
 #include <VistaKernel/GraphicsManager/VistaTransformNode.h>
 #include <VistaKernel/VistaSystem.h>
 #include <VistaKernelOpenSGExt/VistaOpenSGMaterialTools.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <optional>
+
 namespace csp::trajectories {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+// Generations are taken from this counter, so they are unique across all trajectories. Trails may
+// be sampled on multiple threads, hence it is atomic.
+std::atomic<uint64_t> generationCounter{0};
+
+// The names of the frame timers. They are created once, so that starting a timer in each frame
+// does not allocate memory.
+const std::string SAMPLING_TIMER_NAME = "Trajectory Sampling";
+const std::string DRAW_TIMER_NAME     = "Trajectories";
+
+// Passed to the SegmentBVH for trails without velocities.
+const std::vector<glm::dvec3> NO_VELOCITIES;
+
+// Frees the memory of the given vector.
+template <typename T>
+void release(std::vector<T>& vector) {
+  std::vector<T>().swap(vector);
+}
+
+// Returns the number of bytes allocated by the given vector.
+template <typename T>
+size_t getCapacity(std::vector<T> const& vector) {
+  return vector.capacity() * sizeof(T);
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 Trajectory::Trajectory(std::shared_ptr<Plugin::Settings> pluginSettings, std::string sTargetCenter,
     std::string sTargetFrame, std::string const& sParentCenter, std::string const& sParentFrame,
     double tStartExistence, double tEndExistence)
@@ -27,11 +66,11 @@ Trajectory::Trajectory(std::shared_ptr<Plugin::Settings> pluginSettings, std::st
     , mPluginSettings(std::move(pluginSettings))
     , mTargetCenter(std::move(sTargetCenter))
     , mTargetFrame(std::move(sTargetFrame))
-    , mStartIndex(0)
+    , mEphemeris(mTargetCenter, sParentCenter, sParentFrame)
     , mLastUpdateTime(-1.0) {
 
   pLength.connect([this](double val) {
-    mPoints.clear();
+    clearSamples();
     mTrajectory.setMaxAge(val * 24 * 60 * 60);
   });
 
@@ -40,7 +79,8 @@ Trajectory::Trajectory(std::shared_ptr<Plugin::Settings> pluginSettings, std::st
     mTrajectory.setEndColor(glm::vec4(val, 0.F));
   });
 
-  pSamples.connect([this](uint32_t /*value*/) { mPoints.clear(); });
+  pSamples.connect([this](uint32_t /*value*/) { clearSamples(); });
+  pPeriod.connect([this](double /*value*/) { clearSamples(); });
 
   mTrajectory.setUseLinearDepthBuffer(true);
 
@@ -67,70 +107,318 @@ void Trajectory::update(double tTime, cs::scene::CelestialObserver const& oObs)
   mTrailIsInExistence   = (tTime > mStartExistence && tTime < mEndExistence + dLengthSeconds);
 
   if (mPluginSettings->mEnableTrajectories.get() && mTrailIsInExistence) {
+
+    // Evicted trails are only sampled again once they become visible.
+    if (mIsEvicted) {
+      if (!pVisible.get()) {
+        return;
+      }
+
+      mIsEvicted = false;
+    }
+
+    if (!mExternalSampling && !canSkipUpdate(tTime)) {
+      updateSamples(tTime);
+    }
+
+    // The samples may have been updated on another thread. The property notifies its observers,
+    // so it is only set here on the main thread.
+    if (mVisibleRadius > pVisibleRadius.get()) {
+      pVisibleRadius = mVisibleRadius;
+    }
+
+    // If the samples were not updated in this frame, neither here nor by the plugin's thread pool,
+    // the update has been skipped.
+    bool skipUpdate = !mWasSampled;
+    mWasSampled     = false;
+
+    // There is nothing to draw if the tip is unknown, for example while the trail is being loaded
+    // from the cache.
+    if (!mHasTip) {
+      mTrailIsInExistence = false;
+      return;
+    }
+
+    mSegments.refit(mPoints.getSlots(), getSegmentVelocities(), 1.5 * getMaxSampleSpacing(),
+        std::max(pPeriod.get(), 0.0) * 24.0 * 60.0 * 60.0);
+
+    if (pVisible.get()) {
+      // If the update was skipped, the trail is drawn as it was at the time of the last update so
+      // that the tip and the samples fit together.
+      double drawTime   = skipUpdate ? mTipTime : tTime;
+      int    startIndex = static_cast<int>(mPoints.getStart());
+      mDrawTime         = drawTime;
+
+      bool isPeriodic = pPeriod.get() > 0.0;
+      bool isResident = mPluginSettings->mEnableResidentTrails.get() && !mSamplesHaveVelocities;
+
+      if (isPeriodic || isResident) {
+        if (!mRenderer) {
+          mRenderer = std::make_unique<TrailRenderer>();
+        }
+
+        mRenderer->setPeriod(isPeriodic ? pPeriod.get() * 24.0 * 60.0 * 60.0 : 0.0);
+        mRenderer->update(mPoints.getSlots(), startIndex, mTip, drawTime);
+        mUploadedTransform = glm::dmat4(0.0);
+      } else if (!skipUpdate || matWorldTransform != mUploadedTransform) {
+        mUploadedTransform = skipUpdate ? matWorldTransform : glm::dmat4(0.0);
+
+        if (mSamplesHaveVelocities) {
+          tessellate(getMaxSampleSpacing());
+          mTrajectory.upload(matWorldTransform, drawTime, mTessellatedPoints, mTip, 0);
+        } else {
+          mTrajectory.upload(
+              matWorldTransform, drawTime, mPoints.getSlots(), mTip, startIndex);
+        }
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Trajectory::canSkipUpdate(double tTime) const {
+  double threshold = mPluginSettings->mUpdatePixelThreshold.get();
+
+  if (threshold <= 0.0 || !mHasTip || !mHasTipVelocity || !pVisible.get() || mPoints.empty() ||
+      !mPendingSamples.empty()) {
+    return false;
+  }
+
+  // Changed settings are applied by updateSamples().
+  if (mSamplesHaveVelocities != mPluginSettings->mEnableHermiteTrails.get() ||
+      mSamplesAreAligned != mPluginSettings->mAlignSamplesToTimeGrid.get() ||
+      mSamplesAreRebinned != (mPluginSettings->mTrailDetailLevels.get() > 1)) {
+    return false;
+  }
+
+  // The motion of the tip in the parent's coordinate system is extrapolated linearly and projected
+  // to the screen. The motion of the observer does not matter here, as the samples do not depend
+  // on it.
+  glm::dvec3 tip      = glm::dvec3(matWorldTransform * glm::dvec4(mTip, 1.0));
+  double     scale    = glm::length(glm::dvec3(matWorldTransform[0]));
+  double     distance = std::max(glm::length(tip), 1e-10);
+  double     motion   = glm::length(mTipVelocity) * std::abs(tTime - mTipTime) * scale;
+
+  return motion / distance * mPixelsPerRadian < threshold;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::updateSamples(double tTime) {
+  double dLengthSeconds = pLength.get() * 24.0 * 60.0 * 60.0;
+
+  if (mPluginSettings->mEnableTrajectories.get() && tTime > mStartExistence &&
+      tTime < mEndExistence + dLengthSeconds) {
+    // The frame timings cannot be recorded from multiple threads. If the samples are updated
+    // externally, the caller measures the time of all trails together.
+    std::optional<cs::utils::FrameTimings::ScopedTimer> timer;
+    if (!mExternalSampling) {
+      timer.emplace(SAMPLING_TIMER_NAME);
+    }
+
+    mWasSampled = true;
+
+    // If an evicted trail is sampled externally, update() has not been called yet. It must not be
+    // reported as evicted by takeChanges() anymore.
+    mIsEvicted = false;
+
+    if (pPeriod.get() > 0.0) {
+      updatePeriodicSamples(tTime);
+      return;
+    }
+
     double dSampleLength = dLengthSeconds / pSamples.get();
 
-    cs::scene::CelestialAnchor target(mTargetCenter, mTargetFrame);
+    // The maximum number of samples which may be evaluated in this frame.
+    bool   continuousUpdates = mPluginSettings->mEnableContinuousUpdates.get();
+    size_t maxSamples        = std::numeric_limits<size_t>::max();
+
+    if (continuousUpdates) {
+      maxSamples = static_cast<size_t>(std::max(2, mPluginSettings->mMaxSamplesPerFrame.get()));
+    }
 
     // only recalculate if there is not too much change from frame to frame
-    if (std::abs(mLastFrameTime - tTime) <= dLengthSeconds / 10.0) {
+    bool updateRequired =
+        continuousUpdates || std::abs(mLastFrameTime - tTime) <= dLengthSeconds / 10.0;
+    bool useDetailLevels = mPluginSettings->mTrailDetailLevels.get() > 1;
+
+    if (updateRequired && useDetailLevels) {
+      rebinSamples(tTime, dLengthSeconds);
+    }
+
+    if (updateRequired && !useDetailLevels) {
       // make sure to re-sample entire trajectory if complete reset is required
       bool completeRecalculation = false;
 
+      if (mSamplesAreRebinned) {
+        mSamplesAreRebinned   = false;
+        completeRecalculation = true;
+      }
+
       if (mPoints.size() != pSamples.get()) {
-        mPoints.resize(pSamples.get());
+        mPoints.setCapacity(pSamples.get());
+        markAllChanged();
         completeRecalculation = true;
       }
 
+      if (mSamplesHaveVelocities != mPluginSettings->mEnableHermiteTrails.get()) {
+        mSamplesHaveVelocities = mPluginSettings->mEnableHermiteTrails.get();
+        completeRecalculation  = true;
+      }
+
+      if (mSamplesHaveVelocities) {
+        mVelocities.resize(mPoints.size());
+      }
+
       if (tTime > mLastSampleTime + dLengthSeconds || tTime < mLastSampleTime - dLengthSeconds) {
         completeRecalculation = true;
       }
 
+      if (mSamplesAreAligned != mPluginSettings->mAlignSamplesToTimeGrid.get()) {
+        mSamplesAreAligned    = mPluginSettings->mAlignSamplesToTimeGrid.get();
+        completeRecalculation = true;
+      }
+
+      auto samples = static_cast<int64_t>(pSamples.get());
+
+      if (completeRecalculation) {
+        mPendingSamples.clear();
+      }
+
+      // Try to load the trail from the cache. This is only done once for each configuration, the
+      // trail is not drawn while the cache file is being loaded. The cache only contains positions,
+      // so Hermite trails are always sampled.
+      if (completeRecalculation && mCache && !mSamplesHaveVelocities) {
+        std::string key = getCacheKey().toString();
+
+        if (key != mRequestedCacheKey) {
+          mRequestedCacheKey = key;
+          mCacheRequest      = mCache->loadAsync(getCacheKey());
+        }
+
+        if (mCacheRequest.valid()) {
+          if (mCacheRequest.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            mLastFrameTime = tTime;
+            mHasTip        = false;
+            return;
+          }
+
+          if (applyCachedSamples(mCacheRequest.get(), tTime, dLengthSeconds, dSampleLength)) {
+            logger().debug("Loaded trajectory for {} from cache.", mTargetCenter);
+            completeRecalculation = false;
+          }
+        }
+      }
+
+      // Trails which have to be sampled from scratch are only sampled coarsely in this frame. The
+      // remaining samples are interpolated and refined during the following frames. The same is
+      // done if more samples are required than allowed in one frame.
+      size_t coarseSamples   = maxSamples;
+      size_t requiredSamples = pSamples.get() + 1;
+
+      if (completeRecalculation && mPluginSettings->mWarmUpDuration.get() > 0.0) {
+        coarseSamples = std::min(
+            coarseSamples, static_cast<size_t>(std::max(2, mPluginSettings->mWarmUpSamples.get())));
+      }
+
+      if (!completeRecalculation) {
+        double missingTime = (mLastUpdateTime < tTime) ? tTime - mLastSampleTime
+                                                       : mLastSampleTime - dSampleLength - tTime;
+        requiredSamples =
+            static_cast<size_t>(std::max(0.0, std::ceil(missingTime / dSampleLength)));
+      }
+
+      bool coarsePass = requiredSamples > coarseSamples;
+
       if (mLastUpdateTime < tTime) {
         if (completeRecalculation) {
           mLastSampleTime = tTime - dLengthSeconds - dSampleLength;
-          mStartIndex     = 0;
+          mPoints.setStart(0);
+
+          if (mSamplesAreAligned) {
+            mLastSampleIndex = static_cast<int64_t>(std::ceil(tTime / dSampleLength)) - samples - 1;
+            mLastSampleTime  = static_cast<double>(mLastSampleIndex) * dSampleLength;
+          }
         }
 
+        mSampleTimes.clear();
+
         while (mLastSampleTime < tTime) {
-          mLastSampleTime += dSampleLength;
+          if (mSamplesAreAligned) {
+            mLastSampleTime = static_cast<double>(++mLastSampleIndex) * dSampleLength;
+          } else {
+            mLastSampleTime += dSampleLength;
+          }
 
-          try {
-            double     tSampleTime = glm::clamp(mLastSampleTime, mStartExistence, mEndExistence);
-            glm::dvec3 pos         = getRelativePosition(tSampleTime, target);
-            mPoints[mStartIndex]   = glm::dvec4(pos.x, pos.y, pos.z, tSampleTime);
+          double tSampleTime = glm::clamp(mLastSampleTime, mStartExistence, mEndExistence);
 
-            pVisibleRadius = std::max(glm::length(pos), pVisibleRadius.get());
+          if (coarsePass) {
+            mCoarseSlots.emplace_back(static_cast<int>(mPoints.getStart()), tSampleTime);
+            mPoints.advance();
+            continue;
+          }
+
+          mSampleTimes.push_back(tSampleTime);
+        }
+
+        evaluateSamples();
 
-            mStartIndex = (mStartIndex + 1) % static_cast<int>(pSamples.get());
-          } catch (...) {
-            // data might be unavailable
+        // Samples without data are skipped, the next sample will use the same slot.
+        for (size_t i = 0; i < mSampleTimes.size(); ++i) {
+          if (commitSample(static_cast<int>(mPoints.getStart()), i)) {
+            mPoints.advance();
           }
         }
       } else {
         if (completeRecalculation) {
           mLastSampleTime = tTime + dLengthSeconds + dSampleLength;
-          mStartIndex     = 0;
+          mPoints.setStart(0);
+
+          if (mSamplesAreAligned) {
+            mLastSampleIndex =
+                static_cast<int64_t>(std::floor(tTime / dSampleLength)) + samples + 1;
+            mLastSampleTime  = static_cast<double>(mLastSampleIndex) * dSampleLength;
+          }
         }
 
+        mSampleTimes.clear();
+
         while (mLastSampleTime - dSampleLength > tTime) {
-          mLastSampleTime -= dSampleLength;
-
-          try {
-            double tSampleTime =
-                glm::clamp(mLastSampleTime - dLengthSeconds, mStartExistence, mEndExistence);
-            glm::dvec3 pos = getRelativePosition(tSampleTime, target);
-            mPoints[(mStartIndex - 1 + pSamples.get()) % pSamples.get()] =
-                glm::dvec4(pos.x, pos.y, pos.z, tSampleTime);
-
-            mStartIndex = (mStartIndex - 1 + static_cast<int>(pSamples.get())) %
-                          static_cast<int>(pSamples.get());
-            pVisibleRadius = std::max(glm::length(pos), pVisibleRadius.get());
-          } catch (...) {
-            // data might be unavailable
+          double tSampleTime{};
+
+          if (mSamplesAreAligned) {
+            mLastSampleTime = static_cast<double>(--mLastSampleIndex) * dSampleLength;
+            tSampleTime     = static_cast<double>(mLastSampleIndex - samples) * dSampleLength;
+          } else {
+            mLastSampleTime -= dSampleLength;
+            tSampleTime = mLastSampleTime - dLengthSeconds;
+          }
+
+          tSampleTime = glm::clamp(tSampleTime, mStartExistence, mEndExistence);
+
+          if (coarsePass) {
+            mPoints.rewind();
+            mCoarseSlots.emplace_back(static_cast<int>(mPoints.getStart()), tSampleTime);
+            continue;
+          }
+
+          mSampleTimes.push_back(tSampleTime);
+        }
+
+        evaluateSamples();
+
+        for (size_t i = 0; i < mSampleTimes.size(); ++i) {
+          if (commitSample(static_cast<int>(mPoints.getPrevious(mPoints.getStart())), i)) {
+            mPoints.rewind();
           }
         }
       }
 
+      if (coarsePass) {
+        finishCoarsePass(coarseSamples);
+      }
+
       mLastUpdateTime = tTime;
 
       if (completeRecalculation) {
@@ -138,69 +426,1079 @@ void Trajectory::update(double tTime, cs::scene::CelestialObserver const& oObs)
       }
     }
 
+    refinePendingSamples(maxSamples);
+
     mLastFrameTime = tTime;
 
+    // The tip is evaluated with the Ephemeris as well. Unlike a temporary CelestialAnchor, this
+    // neither copies the names of the target nor throws an exception if data is unavailable.
     if (pVisible.get()) {
-      glm::dvec3 tip = getRelativePosition(tTime, target);
-      mTrajectory.upload(matWorldTransform, tTime, mPoints, tip, mStartIndex);
+      glm::dvec3 tip;
+      mEphemeris.getPositions(&tTime, 1, &tip);
+
+      if (std::isnan(tip.x)) {
+        // data might be unavailable
+        mHasTip         = false;
+        mHasTipVelocity = false;
+      } else {
+        // If the time is paused, the tip does not move. The velocity stays valid, so that paused
+        // sessions can skip updates.
+        mHasTipVelocity = mHasTip;
+        if (mHasTip) {
+          mTipVelocity =
+              (tTime != mTipTime) ? (tip - mTip) / (tTime - mTipTime) : glm::dvec3(0.0);
+        }
+
+        mTip     = tip;
+        mTipTime = tTime;
+        mHasTip  = true;
+      }
     }
   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Trajectory::setTargetCenterName(std::string const& sCenterName) {
-  if (mTargetCenter != sCenterName) {
-    mPoints.clear();
-    mTargetCenter = sCenterName;
+void Trajectory::updatePeriodicSamples(double tTime) {
+  double period  = pPeriod.get() * 24.0 * 60.0 * 60.0;
+  size_t samples = pSamples.get();
+  double spacing = period / static_cast<double>(samples);
+
+  bool resample = mPoints.size() != samples;
+
+  if (!resample && mLoopIsValid) {
+    updateLoopTip(tTime);
+  }
+
+  // Compare the loop to the actual position of the target from time to time. If the sampling
+  // failed before, it is retried at the same rate.
+  if (!resample && std::abs(tTime - mLastDriftCheck) > spacing) {
+    mLastDriftCheck = tTime;
+
+    if (mLoopIsValid) {
+      glm::dvec3 actual;
+      mEphemeris.getPositions(&tTime, 1, &actual);
+
+      double drift = glm::length(actual - mTip);
+      resample     = !std::isnan(actual.x) &&
+                 drift > mPluginSettings->mPeriodicDriftTolerance.get() * mLoopRadius;
+
+      if (resample) {
+        logger().debug("Resampling periodic trajectory for {} as it drifted by {:.3f}%.",
+            mTargetCenter, 100.0 * drift / mLoopRadius);
+      }
+    } else {
+      resample = true;
+    }
+  }
+
+  if (resample) {
+    mLastDriftCheck        = tTime;
+    mSamplesAreRebinned    = false;
+    mSamplesHaveVelocities = false;
+    mPendingSamples.clear();
+    mVelocities.clear();
+
+    mSampleTimes.resize(samples);
+    for (size_t i = 0; i < samples; ++i) {
+      mSampleTimes[i] = tTime - period + spacing * static_cast<double>(i);
+    }
+
+    evaluateSamples();
+
+    mPoints.setCapacity(samples);
+    markAllChanged();
+
+    mLoopStart   = mSampleTimes.front();
+    mLoopRadius  = 0.0;
+    mLoopIsValid = true;
+
+    for (size_t i = 0; i < samples; ++i) {
+      if (commitSample(static_cast<int>(i), i)) {
+        mLoopRadius = std::max(mLoopRadius, glm::length(glm::dvec3(mPoints[i])));
+      } else {
+        mLoopIsValid = false;
+      }
+    }
+
+    mSampleTimes.clear();
+
+    if (mLoopIsValid) {
+      updateLoopTip(tTime);
+    } else {
+      logger().debug("Failed to sample periodic trajectory for {}.", mTargetCenter);
+    }
   }
+
+  mHasTip        = mLoopIsValid;
+  mLastFrameTime = tTime;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Trajectory::setTargetFrameName(std::string const& sFrameName) {
-  if (mTargetFrame != sFrameName) {
-    mPoints.clear();
-    mTargetFrame = sFrameName;
+void Trajectory::updateLoopTip(double tTime) {
+  auto   samples = static_cast<double>(mPoints.size());
+  double spacing = pPeriod.get() * 24.0 * 60.0 * 60.0 / samples;
+
+  double phase = (tTime - mLoopStart) / spacing;
+  phase -= samples * std::floor(phase / samples);
+
+  auto index = std::min(static_cast<size_t>(phase), mPoints.size() - 1);
+  auto next  = mPoints.getNext(index);
+
+  mTip = glm::mix(glm::dvec3(mPoints[index]), glm::dvec3(mPoints[next]),
+      phase - static_cast<double>(index));
+
+  // The order of the samples changes without any sample being changed if the start moves along the
+  // loop. Views of the samples have to notice this as well.
+  if (next != mPoints.getStart()) {
+    mPoints.setStart(next);
+    mGeneration = ++generationCounter;
   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-std::string const& Trajectory::getTargetCenterName() const {
-  return mTargetCenter;
+void Trajectory::setExternalSampling(bool enable) {
+  mExternalSampling = enable;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-std::string const& Trajectory::getTargetFrameName() const {
-  return mTargetFrame;
+bool Trajectory::needsSampling(double tTime) const {
+  double dLengthSeconds = pLength.get() * 24.0 * 60.0 * 60.0;
+
+  if (!mPluginSettings->mEnableTrajectories.get() || tTime <= mStartExistence ||
+      tTime >= mEndExistence + dLengthSeconds) {
+    return false;
+  }
+
+  if (mIsEvicted && !pVisible.get()) {
+    return false;
+  }
+
+  return !canSkipUpdate(tTime);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Trajectory::setCenterName(std::string const& sCenterName) {
-  if (sCenterName != getCenterName()) {
-    mPoints.clear();
+void Trajectory::setRecordChanges(bool enable) {
+  if (mRecordChanges != enable) {
+    mRecordChanges = enable;
+    markAllChanged();
   }
-  cs::scene::CelestialObject::setCenterName(sCenterName);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void Trajectory::setFrameName(std::string const& sFrameName) {
-  if (sFrameName != getFrameName()) {
-    mPoints.clear();
+void Trajectory::takeChanges(Changes& changes) {
+  changes.mCapacity      = static_cast<uint32_t>(mPoints.size());
+  changes.mStartIndex    = static_cast<int32_t>(mPoints.getStart());
+  changes.mHasVelocities = mSamplesHaveVelocities;
+  changes.mHasTip        = mHasTip;
+  changes.mIsEvicted     = mIsEvicted;
+  changes.mTip           = mTip;
+  changes.mVisibleRadius = mVisibleRadius;
+
+  changes.mSlots.clear();
+  changes.mPoints.clear();
+  changes.mVelocities.clear();
+
+  if (mAllSlotsChanged) {
+    mChangedSlots.resize(mPoints.size());
+    std::iota(mChangedSlots.begin(), mChangedSlots.end(), 0);
   }
-  cs::scene::CelestialObject::setFrameName(sFrameName);
+
+  for (int slot : mChangedSlots) {
+    if (slot < static_cast<int>(mPoints.size())) {
+      changes.mSlots.push_back(static_cast<uint32_t>(slot));
+      changes.mPoints.push_back(mPoints[slot]);
+
+      if (mSamplesHaveVelocities) {
+        changes.mVelocities.push_back(mVelocities[slot]);
+      }
+    }
+  }
+
+  mChangedSlots.clear();
+  mSlotChanged.assign(mPoints.size(), false);
+  mAllSlotsChanged = false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool Trajectory::Do() {
-  if (mPluginSettings->mEnableTrajectories.get() && pVisible.get() && mTrailIsInExistence) {
-    cs::utils::FrameTimings::ScopedTimer timer("Trajectories");
-    mTrajectory.Do();
+void Trajectory::applyChanges(Changes const& changes) {
+  if (changes.mIsEvicted) {
+    if (!mIsEvicted) {
+      evict();
+      logger().debug(
+          "Evicted samples of trajectory for {} like on the leader node.", mTargetCenter);
+    }
+    return;
+  }
+
+  mWasSampled = true;
+  mIsEvicted  = false;
+
+  if (mPoints.size() != changes.mCapacity) {
+    mPoints.setCapacity(changes.mCapacity);
+    markAllChanged();
+  }
+
+  mSamplesHaveVelocities = changes.mHasVelocities;
+
+  if (mSamplesHaveVelocities) {
+    mVelocities.resize(mPoints.size());
+  }
+
+  for (size_t i = 0; i < changes.mSlots.size(); ++i) {
+    uint32_t slot = changes.mSlots[i];
+
+    if (slot < mPoints.size()) {
+      mPoints[slot] = changes.mPoints[i];
+      markChanged(static_cast<int>(slot));
+
+      if (mSamplesHaveVelocities && i < changes.mVelocities.size()) {
+        mVelocities[slot] = changes.mVelocities[i];
+      }
+    }
+  }
+
+  // See updateLoopTip().
+  if (static_cast<size_t>(changes.mStartIndex) != mPoints.getStart()) {
+    mPoints.setStart(static_cast<size_t>(changes.mStartIndex));
+    mGeneration = ++generationCounter;
+  }
+
+  mHasTip        = changes.mHasTip;
+  mTip           = changes.mTip;
+  mVisibleRadius = changes.mVisibleRadius;
+  pVisibleRadius = mVisibleRadius;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<Trajectory::Pick> Trajectory::intersect(
+    glm::dvec3 const& rayOrigin, glm::dvec3 const& rayDirection, double maxAngle) const {
+
+  if (!mTrailIsInExistence || !pVisible.get()) {
+    return std::nullopt;
+  }
+
+  // The samples are stored relative to the parent. Angles are not affected by the uniform scale
+  // of the world transform.
+  glm::dmat4 matInverse = glm::inverse(matWorldTransform);
+  glm::dvec3 origin     = glm::dvec3(matInverse * glm::dvec4(rayOrigin, 1.0));
+  glm::dvec3 direction  = glm::normalize(glm::dvec3(matInverse * glm::dvec4(rayDirection, 0.0)));
+
+  auto hit = mSegments.intersect(mPoints.getSlots(), getSegmentVelocities(), getVisibleWindow(),
+      origin, direction, maxAngle);
+
+  if (!hit) {
+    return std::nullopt;
+  }
+
+  glm::dvec3 position = glm::dvec3(matWorldTransform * glm::dvec4(hit->mPosition, 1.0));
+  return Pick{hit->mTime, position, hit->mError};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::optional<Trajectory::Pick> Trajectory::getNearestPoint(
+    glm::dvec3 const& position, double maxDistance) const {
+
+  if (!mTrailIsInExistence || !pVisible.get()) {
+    return std::nullopt;
+  }
+
+  double     scale      = glm::length(glm::dvec3(matWorldTransform[0]));
+  glm::dmat4 matInverse = glm::inverse(matWorldTransform);
+  glm::dvec3 local      = glm::dvec3(matInverse * glm::dvec4(position, 1.0));
+
+  auto hit = mSegments.getNearest(mPoints.getSlots(), getSegmentVelocities(), getVisibleWindow(),
+      local, maxDistance / scale);
+
+  if (!hit) {
+    return std::nullopt;
+  }
+
+  glm::dvec3 point = glm::dvec3(matWorldTransform * glm::dvec4(hit->mPosition, 1.0));
+  return Pick{hit->mTime, point, hit->mError * scale};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::clearSamples() {
+  mPoints.clear();
+  mGeneration = ++generationCounter;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Plugin::TrailView Trajectory::getView() const {
+  Plugin::TrailView view;
+  view.mGeneration   = mGeneration;
+  view.mParentCenter = getCenterName();
+  view.mParentFrame  = getFrameName();
+
+  if (mPoints.empty()) {
+    return view;
+  }
+
+  auto [older, newer] = mPoints.getSpans();
+  view.mOlder         = {older.mData, older.mSize};
+  view.mNewer         = {newer.mData, newer.mSize};
+
+  return view;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t Trajectory::getGeneration() const {
+  return mGeneration;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::markChanged(int slot) {
+  mGeneration = ++generationCounter;
+  mSegments.invalidate(static_cast<size_t>(slot));
+  if (mRenderer) {
+    mRenderer->invalidate(static_cast<size_t>(slot));
+  }
+
+  if (!mRecordChanges || mAllSlotsChanged) {
+    return;
+  }
+
+  if (mSlotChanged.size() != mPoints.size()) {
+    mSlotChanged.assign(mPoints.size(), false);
+  }
+
+  if (!mSlotChanged[slot]) {
+    mSlotChanged[slot] = true;
+    mChangedSlots.push_back(slot);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::markAllChanged() {
+  mGeneration = ++generationCounter;
+  mSegments.invalidateAll();
+  if (mRenderer) {
+    mRenderer->invalidateAll();
+  }
+  mAllSlotsChanged = mRecordChanges;
+  mChangedSlots.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::evaluateSamples() {
+  mSamplePositions.resize(mSampleTimes.size());
+
+  if (mSamplesHaveVelocities) {
+    mSampleVelocities.resize(mSampleTimes.size());
+    mEphemeris.getStates(mSampleTimes.data(), mSampleTimes.size(), mSamplePositions.data(),
+        mSampleVelocities.data());
+  } else {
+    mEphemeris.getPositions(mSampleTimes.data(), mSampleTimes.size(), mSamplePositions.data());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Trajectory::commitSample(int slot, size_t i) {
+  glm::dvec3 const& pos = mSamplePositions[i];
+
+  // data might be unavailable
+  if (std::isnan(pos.x)) {
+    return false;
+  }
+
+  if (mSamplesHaveVelocities) {
+    mVelocities[slot] = mSampleVelocities[i];
+  }
+
+  mPoints[slot]  = glm::dvec4(pos.x, pos.y, pos.z, mSampleTimes[i]);
+  mVisibleRadius = std::max(glm::length(pos), mVisibleRadius);
+  markChanged(slot);
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::tessellate(double dSampleLength) {
+  // The maximum number of linear pieces per Hermite segment.
+  const int maxPieces = 32;
+
+  double pieceLength = std::max(1.0, mPluginSettings->mHermiteSegmentPixels.get());
+  size_t count       = mPoints.size();
+
+  mTessellatedPoints.clear();
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t      i0 = mPoints.getSlot(i);
+    size_t      i1 = mPoints.getNext(i0);
+    auto const& p0 = mPoints[i0];
+    auto const& p1 = mPoints[i1];
+
+    mTessellatedPoints.push_back(p0);
+
+    // Segments between samples which are not adjacent in time (for example if some data was
+    // unavailable) or where a sample was clamped to the existence of the trajectory are drawn as
+    // straight lines.
+    double dt = p1.w - p0.w;
+    if (i + 1 == count || dt <= 0.0 || dt > 1.5 * dSampleLength) {
+      continue;
+    }
+
+    // Estimate the angular size of the segment as seen from the observer which is located at the
+    // origin of world space.
+    glm::dvec3 w0 = glm::dvec3(matWorldTransform * glm::dvec4(glm::dvec3(p0), 1.0));
+    glm::dvec3 w1 = glm::dvec3(matWorldTransform * glm::dvec4(glm::dvec3(p1), 1.0));
+
+    double distance = std::min(glm::length(w0), glm::length(w1));
+    double pixels   = glm::length(w1 - w0) / std::max(distance, 1e-10) * mPixelsPerRadian;
+    int    pieces   = glm::clamp(static_cast<int>(std::ceil(pixels / pieceLength)), 1, maxPieces);
+
+    glm::dvec3 m0 = mVelocities[i0] * dt;
+    glm::dvec3 m1 = mVelocities[i1] * dt;
+
+    for (int j = 1; j < pieces; ++j) {
+      double s  = static_cast<double>(j) / pieces;
+      double s2 = s * s;
+      double s3 = s2 * s;
+
+      glm::dvec3 pos = (2.0 * s3 - 3.0 * s2 + 1.0) * glm::dvec3(p0) + (s3 - 2.0 * s2 + s) * m0 +
+                       (-2.0 * s3 + 3.0 * s2) * glm::dvec3(p1) + (s3 - s2) * m1;
+
+      mTessellatedPoints.emplace_back(pos.x, pos.y, pos.z, p0.w + s * dt);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double Trajectory::getMaxSampleSpacing() const {
+  if (pPeriod.get() > 0.0) {
+    return pPeriod.get() * 24.0 * 60.0 * 60.0 / pSamples.get();
+  }
+
+  double dLengthSeconds = pLength.get() * 24.0 * 60.0 * 60.0;
+  int    levels         = glm::clamp(mPluginSettings->mTrailDetailLevels.get(), 1, 16);
+
+  if (levels == 1) {
+    return dLengthSeconds / pSamples.get();
+  }
+
+  // See rebinSamples() for the layout of the levels.
+  auto   perLevel = std::max<int64_t>(2, static_cast<int64_t>(pSamples.get()) / levels);
+  double spacing =
+      dLengthSeconds / static_cast<double>(perLevel * ((int64_t{1} << levels) - 1));
+
+  return spacing * static_cast<double>(int64_t{1} << (levels - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SegmentBVH::TimeWindow Trajectory::getVisibleWindow() const {
+  double maxAge = mTrajectory.getMaxAge();
+
+  // Periodic trails are drawn with at most one period, see Do().
+  if (pPeriod.get() > 0.0) {
+    maxAge = std::min(maxAge, pPeriod.get() * 24.0 * 60.0 * 60.0);
+  }
+
+  return {mDrawTime - maxAge, mDrawTime};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::vector<glm::dvec3> const& Trajectory::getSegmentVelocities() const {
+  bool isValid = mSamplesHaveVelocities && mVelocities.size() == mPoints.size();
+  return isValid ? mVelocities : NO_VELOCITIES;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::rebinSamples(double tTime, double dLengthSeconds) {
+  int levels = std::min(mPluginSettings->mTrailDetailLevels.get(), 16);
+
+  // Each level contains perLevel samples. The samples of level k are 2^k * spacing apart, so that
+  // all levels together cover the length of the trail. All sample times are integer multiples of
+  // their level's distance, so each sample of a coarser level has been a sample of the next finer
+  // level before. Hence, when time advances, samples move to the coarser levels without being
+  // evaluated again.
+  auto   perLevel = std::max<int64_t>(2, static_cast<int64_t>(pSamples.get()) / levels);
+  double spacing =
+      dLengthSeconds / static_cast<double>(perLevel * ((int64_t{1} << levels) - 1));
+  auto tipIndex = static_cast<int64_t>(std::floor(tTime / spacing));
+
+  bool hasVelocities = mPluginSettings->mEnableHermiteTrails.get();
+
+  // Nothing changes until the tip reaches the next sample time.
+  if (mSamplesAreRebinned && tipIndex == mLastSampleIndex && spacing == mRebinnedSpacing &&
+      hasVelocities == mSamplesHaveVelocities && !mPoints.empty()) {
+    return;
+  }
+
+  // If the samples were not taken with velocities, none of them can be reused.
+  if (hasVelocities != mSamplesHaveVelocities) {
+    mSamplesHaveVelocities = hasVelocities;
+    mPoints.clear();
+  }
+
+  if (mSamplesHaveVelocities) {
+    mVelocities.resize(mPoints.size());
+  }
+
+  mPendingSamples.clear();
+  mCoarseSlots.clear();
+
+  // Collect the desired sample indices from the tip to the tail, each in units of spacing.
+  mRebinnedPoints.clear();
+
+  int64_t index = tipIndex;
+  for (int level = 0; level < levels; ++level) {
+    int64_t step = int64_t{1} << level;
+
+    // Start with the first multiple of step which is older than the last sample of the previous
+    // level.
+    if (level > 0) {
+      index = (index - 1) - (((index - 1) % step) + step) % step;
+    }
+
+    for (int64_t i = 0; i < perLevel; ++i, index -= step) {
+      double time = glm::clamp(static_cast<double>(index) * spacing, mStartExistence,
+          mEndExistence);
+      mRebinnedPoints.emplace_back(0.0, 0.0, 0.0, time);
+    }
+
+    index += step;
+  }
+
+  std::reverse(mRebinnedPoints.begin(), mRebinnedPoints.end());
+
+  // Now walk through the old samples in chronological order and reuse all which have exactly the
+  // desired times. The others are collected for evaluation.
+  mRebinnedVelocities.resize(mSamplesHaveVelocities ? mRebinnedPoints.size() : 0);
+  mSampleTimes.clear();
+  mSampleSlots.clear();
+
+  size_t oldCount = mPoints.size();
+  size_t old      = 0;
+
+  for (size_t i = 0; i < mRebinnedPoints.size(); ++i) {
+    double time = mRebinnedPoints[i].w;
+
+    while (old < oldCount && mPoints[mPoints.getSlot(old)].w < time) {
+      ++old;
+    }
+
+    size_t oldSlot = mPoints.getSlot(old);
+
+    if (old < oldCount && mPoints[oldSlot].w == time && mPoints[oldSlot] != glm::dvec4(0.0)) {
+      mRebinnedPoints[i] = mPoints[oldSlot];
+
+      if (mSamplesHaveVelocities) {
+        mRebinnedVelocities[i] = mVelocities[oldSlot];
+      }
+    } else {
+      mSampleTimes.push_back(time);
+      mSampleSlots.push_back(static_cast<int>(i));
+    }
+  }
+
+  evaluateSamples();
+
+  // Samples without data are marked with a NaN time.
+  bool hasGaps = false;
+
+  for (size_t i = 0; i < mSampleTimes.size(); ++i) {
+    glm::dvec3 const& pos   = mSamplePositions[i];
+    auto&             point = mRebinnedPoints[mSampleSlots[i]];
+
+    if (std::isnan(pos.x)) {
+      point.w = std::numeric_limits<double>::quiet_NaN();
+      hasGaps = true;
+      continue;
+    }
+
+    point          = glm::dvec4(pos.x, pos.y, pos.z, mSampleTimes[i]);
+    mVisibleRadius = std::max(glm::length(pos), mVisibleRadius);
+
+    if (mSamplesHaveVelocities) {
+      mRebinnedVelocities[mSampleSlots[i]] = mSampleVelocities[i];
+    }
+  }
+
+  // Usually, the tip only advanced by a few samples. Then only these and the samples which moved
+  // to another level have to be written, all others stay in their slots.
+  if (mSamplesAreRebinned && !hasGaps && mPoints.size() == mRebinnedPoints.size()) {
+    placeRebinnedSamples();
+  } else {
+    // Samples without data are removed.
+    size_t count = 0;
+
+    for (size_t i = 0; i < mRebinnedPoints.size(); ++i) {
+      if (!std::isnan(mRebinnedPoints[i].w)) {
+        mRebinnedPoints[count] = mRebinnedPoints[i];
+
+        if (mSamplesHaveVelocities) {
+          mRebinnedVelocities[count] = mRebinnedVelocities[i];
+        }
+
+        ++count;
+      }
+    }
+
+    mRebinnedPoints.resize(count);
+    mRebinnedVelocities.resize(mSamplesHaveVelocities ? count : 0);
+
+    mPoints.swap(mRebinnedPoints);
+    std::swap(mVelocities, mRebinnedVelocities);
+    markAllChanged();
+
+    logger().debug("Rebinned trajectory for {}, evaluated {} of {} samples.", mTargetCenter,
+        mSampleTimes.size(), mPoints.size());
+  }
+
+  mSamplesAreRebinned = true;
+  mRebinnedSpacing    = spacing;
+  mLastSampleIndex    = tipIndex;
+  mLastSampleTime     = static_cast<double>(tipIndex) * spacing;
+  mLastUpdateTime     = tTime;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::placeRebinnedSamples() {
+  size_t count = mPoints.size();
+
+  if (count == 0) {
+    return;
+  }
+
+  // When the tip advances, new samples are appended at the tip and a few samples are dropped at
+  // the borders of the levels. All samples in between keep their order. If the start stays, the
+  // samples between the tip and the last dropped one move. If it advances by the number of new
+  // samples, those between the tail and the first dropped one move instead. The start for which
+  // fewer slots change is used.
+  double newest   = mPoints[mPoints.getPrevious(mPoints.getStart())].w;
+  size_t appended = 0;
+
+  while (appended < count && mRebinnedPoints[count - 1 - appended].w > newest) {
+    ++appended;
+  }
+
+  auto countChanges = [this, count](size_t start) {
+    size_t changes = 0;
+    for (size_t i = 0; i < count; ++i) {
+      changes += mPoints[(start + i) % count] != mRebinnedPoints[i] ? 1 : 0;
+    }
+    return changes;
+  };
+
+  size_t start = mPoints.getStart();
+  size_t moved = (start + appended) % count;
+
+  if (countChanges(moved) < countChanges(start)) {
+    start = moved;
+  }
+
+  mPoints.setStart(start);
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t slot = mPoints.getSlot(i);
+
+    if (mPoints[slot] != mRebinnedPoints[i]) {
+      mPoints[slot] = mRebinnedPoints[i];
+
+      if (mSamplesHaveVelocities) {
+        mVelocities[slot] = mRebinnedVelocities[i];
+      }
+
+      markChanged(static_cast<int>(slot));
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::finishCoarsePass(size_t maxSamples) {
+  if (mCoarseSlots.empty()) {
+    return;
+  }
+
+  // Sample every n-th slot and always the last one, as this is the one closest to the tip.
+  auto stride =
+      std::max<size_t>(1, (mCoarseSlots.size() + maxSamples - 3) / (maxSamples - 1));
+  auto& candidates = mCoarseCandidates;
+  auto& anchors    = mCoarseAnchors;
+
+  candidates.clear();
+  anchors.clear();
+
+  for (size_t i = 0; i < mCoarseSlots.size(); i += stride) {
+    candidates.push_back(i);
+  }
+
+  if ((mCoarseSlots.size() - 1) % stride != 0) {
+    candidates.push_back(mCoarseSlots.size() - 1);
+  }
+
+  mSampleTimes.clear();
+  for (size_t i : candidates) {
+    mSampleTimes.push_back(mCoarseSlots[i].second);
+  }
+
+  evaluateSamples();
+
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (commitSample(mCoarseSlots[candidates[i]].first, i)) {
+      anchors.push_back(candidates[i]);
+    }
+  }
+
+  size_t oldPendingCount = mPendingSamples.size();
+
+  // Now interpolate all slots between the sampled ones. Slots before the first or after the last
+  // successfully sampled slot get the position of the closest sampled one.
+  size_t nextAnchor = 0;
+
+  for (size_t i = 0; i < mCoarseSlots.size() && !anchors.empty(); ++i) {
+    while (nextAnchor < anchors.size() && anchors[nextAnchor] < i) {
+      ++nextAnchor;
+    }
+
+    if (nextAnchor < anchors.size() && anchors[nextAnchor] == i) {
+      continue;
+    }
+
+    size_t i0 = anchors[nextAnchor == 0 ? 0 : nextAnchor - 1];
+    size_t i1 = anchors[nextAnchor == anchors.size() ? anchors.size() - 1 : nextAnchor];
+    int    s0 = mCoarseSlots[i0].first;
+    int    s1 = mCoarseSlots[i1].first;
+    double a  = (i0 == i1) ? 0.0 : static_cast<double>(i - i0) / static_cast<double>(i1 - i0);
+
+    auto [slot, tSampleTime] = mCoarseSlots[i];
+    glm::dvec3 pos           = glm::mix(glm::dvec3(mPoints[s0]), glm::dvec3(mPoints[s1]), a);
+    mPoints[slot]            = glm::dvec4(pos.x, pos.y, pos.z, tSampleTime);
+
+    if (mSamplesHaveVelocities) {
+      mVelocities[slot] = glm::mix(mVelocities[s0], mVelocities[s1], a);
+    }
+
+    markChanged(slot);
+    mPendingSamples.emplace_back(slot, tSampleTime);
+  }
+
+  mCoarseSlots.clear();
+
+  auto isStale = [this](std::pair<int, double> const& pending) {
+    return pending.first >= static_cast<int>(mPoints.size()) ||
+           mPoints[pending.first].w != pending.second;
+  };
+
+  auto byTime = [](std::pair<int, double> const& a, std::pair<int, double> const& b) {
+    return a.second < b.second;
+  };
+
+  // Pending samples whose slots have just been overwritten will never be refined. They are removed
+  // here, so that the list does not grow if there is a coarse pass in each frame.
+  auto oldEnd   = mPendingSamples.begin() + static_cast<std::ptrdiff_t>(oldPendingCount);
+  auto newBegin = mPendingSamples.erase(
+      std::remove_if(mPendingSamples.begin(), oldEnd, isStale), oldEnd);
+
+  // A coarse pass extends the trail at one end, so the new samples are either all newer or all
+  // older than the pending ones. If the trail was extended into the past, they have been collected
+  // backwards in time. Hence they are inserted as one block instead of sorting the entire list.
+  if (!std::is_sorted(newBegin, mPendingSamples.end(), byTime)) {
+    std::reverse(newBegin, mPendingSamples.end());
+  }
+
+  if (newBegin != mPendingSamples.end()) {
+    auto position = std::upper_bound(mPendingSamples.begin(), newBegin, *newBegin, byTime);
+    std::rotate(position, newBegin, mPendingSamples.end());
+  }
+
+  // If there were pending samples already, their deadline is kept. Otherwise, it would be
+  // postponed by each coarse pass and the samples would never be refined in continuous mode.
+  auto now      = std::chrono::steady_clock::now();
+  auto deadline = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(mPluginSettings->mWarmUpDuration.get()));
+
+  if (oldPendingCount == 0) {
+    mLastRefinementTime = now;
+    mRefinementDeadline = deadline;
+  } else {
+    mRefinementDeadline = std::min(mRefinementDeadline, deadline);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::refinePendingSamples(size_t maxSamples) {
+  if (mPendingSamples.empty()) {
+    return;
+  }
+
+  // Distribute the remaining samples evenly over the remaining warm-up duration.
+  auto   now       = std::chrono::steady_clock::now();
+  double remaining = std::chrono::duration<double>(mRefinementDeadline - now).count();
+  double elapsed   = std::chrono::duration<double>(now - mLastRefinementTime).count();
+  mLastRefinementTime = now;
+
+  size_t budget = mPendingSamples.size();
+
+  if (remaining > elapsed) {
+    budget = static_cast<size_t>(std::ceil(static_cast<double>(budget) * elapsed / remaining));
+  }
+
+  budget = std::min(budget, maxSamples);
+
+  mSampleTimes.clear();
+  mSampleSlots.clear();
+
+  while (budget > 0 && !mPendingSamples.empty()) {
+    auto [slot, tSampleTime] = mPendingSamples.back();
+    mPendingSamples.pop_back();
+
+    // The slot may have been overwritten by a new sample in the meantime.
+    if (slot >= static_cast<int>(mPoints.size()) || mPoints[slot].w != tSampleTime) {
+      continue;
+    }
+
+    mSampleTimes.push_back(tSampleTime);
+    mSampleSlots.push_back(slot);
+
+    --budget;
+  }
+
+  evaluateSamples();
+
+  for (size_t i = 0; i < mSampleTimes.size(); ++i) {
+    commitSample(mSampleSlots[i], i);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TrailCache::Key Trajectory::getCacheKey() const {
+  return {mTargetCenter, mTargetFrame, getCenterName(), getFrameName(), pSamples.get(),
+      pLength.get(), mStartExistence, mEndExistence, mSamplesHaveVelocities, mSamplesAreAligned,
+      mSamplesAreRebinned ? mPluginSettings->mTrailDetailLevels.get() : 1};
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Trajectory::applyCachedSamples(std::vector<glm::dvec4> const& samples, double tTime,
+    double dLengthSeconds, double dSampleLength) {
+
+  // The newest cached sample must lie within the current trail and must not be more than one
+  // sample ahead of the current time. All samples between the newest cached sample and the
+  // current time are sampled incrementally afterwards.
+  if (samples.size() != mPoints.size() || samples.empty() ||
+      samples.back().w <= tTime - dLengthSeconds || samples.back().w > tTime + dSampleLength) {
+    return false;
+  }
+
+  // Samples which are not aligned to the time grid cannot be used if alignment is requested.
+  auto lastSampleIndex = static_cast<int64_t>(std::llround(samples.back().w / dSampleLength));
+
+  if (mSamplesAreAligned &&
+      static_cast<double>(lastSampleIndex) * dSampleLength != samples.back().w) {
+    return false;
+  }
+
+  std::copy(samples.begin(), samples.end(), mPoints.data());
+  markAllChanged();
+  mPoints.setStart(0);
+  mLastSampleTime  = samples.back().w;
+  mLastSampleIndex = lastSampleIndex;
+
+  for (auto const& sample : samples) {
+    mVisibleRadius = std::max(glm::length(glm::dvec3(sample)), mVisibleRadius);
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::setCache(std::shared_ptr<TrailCache> cache) {
+  mCache = std::move(cache);
+  mRequestedCacheKey.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::saveToCache() const {
+  if (!mCache || mSamplesAreRebinned || mSamplesHaveVelocities || pPeriod.get() > 0.0 ||
+      mPoints.size() != pSamples.get() || !mPendingSamples.empty()) {
+    return;
+  }
+
+  // Store the samples in chronological order. Trails which could not be sampled completely, for
+  // example because data is unavailable, are not stored.
+  std::vector<glm::dvec4> samples;
+  samples.reserve(mPoints.size());
+
+  for (size_t i = 0; i < mPoints.size(); ++i) {
+    auto const& sample = mPoints[mPoints.getSlot(i)];
+
+    if (sample == glm::dvec4(0.0)) {
+      return;
+    }
+
+    samples.push_back(sample);
+  }
+
+  mCache->save(getCacheKey(), samples);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t Trajectory::getMemoryUsage() const {
+  return mPoints.getMemoryUsage() + getCapacity(mVelocities) + getCapacity(mTessellatedPoints) +
+         getCapacity(mRebinnedPoints) + getCapacity(mRebinnedVelocities) +
+         getCapacity(mSampleTimes) + getCapacity(mSampleSlots) + getCapacity(mSamplePositions) +
+         getCapacity(mSampleVelocities) + getCapacity(mCoarseSlots) +
+         getCapacity(mCoarseCandidates) + getCapacity(mCoarseAnchors) +
+         getCapacity(mPendingSamples) + getCapacity(mChangedSlots) + mSlotChanged.capacity() / 8 +
+         mSegments.getMemoryUsage() + (mRenderer ? mRenderer->getMemoryUsage() : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Trajectory::canBeEvicted() const {
+  bool isDrawn =
+      mPluginSettings->mEnableTrajectories.get() && pVisible.get() && mTrailIsInExistence;
+  return !isDrawn && !mIsEvicted;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::chrono::steady_clock::time_point Trajectory::getLastVisibleTime() const {
+  return mLastVisibleTime;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::evict() {
+  clearSamples();
+
+  mPoints.release();
+  release(mVelocities);
+  release(mTessellatedPoints);
+  release(mRebinnedPoints);
+  release(mRebinnedVelocities);
+  release(mSampleTimes);
+  release(mSampleSlots);
+  release(mSamplePositions);
+  release(mSampleVelocities);
+  release(mCoarseSlots);
+  release(mCoarseCandidates);
+  release(mCoarseAnchors);
+  release(mPendingSamples);
+  release(mChangedSlots);
+  release(mSlotChanged);
+
+  mSegments.clear();
+  mRenderer.reset();
+
+  mHasTip    = false;
+  mIsEvicted = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::setTargetCenterName(std::string const& sCenterName) {
+  if (mTargetCenter != sCenterName) {
+    clearSamples();
+    mTargetCenter = sCenterName;
+    mEphemeris.setTargetCenterName(sCenterName);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::setTargetFrameName(std::string const& sFrameName) {
+  if (mTargetFrame != sFrameName) {
+    clearSamples();
+    mTargetFrame = sFrameName;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string const& Trajectory::getTargetCenterName() const {
+  return mTargetCenter;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string const& Trajectory::getTargetFrameName() const {
+  return mTargetFrame;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::setCenterName(std::string const& sCenterName) {
+  if (sCenterName != getCenterName()) {
+    clearSamples();
+  }
+  mEphemeris.setObserverCenterName(sCenterName);
+  cs::scene::CelestialObject::setCenterName(sCenterName);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Trajectory::setFrameName(std::string const& sFrameName) {
+  if (sFrameName != getFrameName()) {
+    clearSamples();
+  }
+  mEphemeris.setObserverFrameName(sFrameName);
+  cs::scene::CelestialObject::setFrameName(sFrameName);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool Trajectory::Do() {
+  if (mPluginSettings->mEnableTrajectories.get() && pVisible.get() && mTrailIsInExistence) {
+    cs::utils::FrameTimings::ScopedTimer timer(DRAW_TIMER_NAME);
+
+    mLastVisibleTime = std::chrono::steady_clock::now();
+
+    // Store the current vertical resolution for choosing the tessellation of the next frame and
+    // for estimating the on-screen motion of the tip.
+    if (mSamplesHaveVelocities || mPluginSettings->mUpdatePixelThreshold.get() > 0.0) {
+      std::array<GLint, 4>    viewport{};
+      std::array<GLfloat, 16> glMatP{};
+      glGetIntegerv(GL_VIEWPORT, viewport.data());
+      glGetFloatv(GL_PROJECTION_MATRIX, glMatP.data());
+      mPixelsPerRadian = 0.5 * viewport.at(3) * glMatP.at(5);
+    }
+
+    // The renderer is created in update(). If the settings changed in between, nothing is drawn
+    // in this frame.
+    if (pPeriod.get() > 0.0) {
+      double maxAge = std::min(mTrajectory.getMaxAge(), pPeriod.get() * 24.0 * 60.0 * 60.0);
+      if (mRenderer) {
+        mRenderer->draw(matWorldTransform, mTrajectory.getStartColor(), mTrajectory.getEndColor(),
+            maxAge, mTrajectory.getWidth());
+      }
+    } else if (!mSamplesHaveVelocities && mPluginSettings->mEnableResidentTrails.get()) {
+      if (mRenderer) {
+        mRenderer->draw(matWorldTransform, mTrajectory.getStartColor(), mTrajectory.getEndColor(),
+            mTrajectory.getMaxAge(), mTrajectory.getWidth());
+      }
+    } else {
+      mTrajectory.Do();
+    }
   }
 
   return true;
@@ -7,13 +7,19 @@
 #ifndef CSP_TRAJECTORIES_TRAJECTORY_HPP
 #define CSP_TRAJECTORIES_TRAJECTORY_HPP
 
+#include "Ephemeris.hpp"
 #include "Plugin.hpp"
+#include "SegmentBVH.hpp"
+#include "TrailBuffer.hpp"
+#include "TrailCache.hpp"
+#include "TrailRenderer.hpp"
 
 #include "../../../src/cs-scene/CelestialObject.hpp"
 #include "../../../src/cs-scene/Trajectory.hpp"
 
 #include <VistaBase/VistaColor.h>
 #include <VistaKernel/GraphicsManager/VistaOpenGLDraw.h>
+#include <chrono>
 #include <memory>
 
 namespace csp::trajectories {
@@ -27,6 +33,10 @@ class Trajectory : public cs::scene::CelestialObject, public IVistaOpenGLDraw {
   /// The trajectory is drawn using this many linear pieces.
   cs::utils::Property<uint32_t> pSamples = 100;
 
+  /// If larger than zero, the target is assumed to move on a closed orbit with this period in
+  /// days. See updatePeriodicSamples().
+  cs::utils::Property<double> pPeriod = 0.0;
+
   /// The color of the trajectory.
   cs::utils::Property<glm::vec3> pColor = glm::vec3(1, 1, 1);
 
@@ -42,9 +52,75 @@ class Trajectory : public cs::scene::CelestialObject, public IVistaOpenGLDraw {
 
   ~Trajectory() override;
 
+  /// The samples which changed since the last call to takeChanges() together with the current
+  /// state of the ring buffer. This is used for sending the samples from the master node of a
+  /// cluster to all other nodes.
+  struct Changes {
+    uint32_t                mCapacity{};
+    int32_t                 mStartIndex{};
+    bool                    mHasVelocities{};
+    bool                    mHasTip{};
+    bool                    mIsEvicted{};
+    glm::dvec3              mTip{};
+    double                  mVisibleRadius{};
+    std::vector<uint32_t>   mSlots;
+    std::vector<glm::dvec4> mPoints;
+    std::vector<glm::dvec3> mVelocities;
+  };
+
   /// This is called automatically by the SolarSystem.
   void update(double tTime, cs::scene::CelestialObserver const& oObs) override;
 
+  /// Evaluates all new samples for the given simulation time. This is usually called by update().
+  /// If external sampling is enabled, this has to be called once per frame before update().
+  void updateSamples(double tTime);
+
+  /// If enabled, update() does not sample the trail anymore, it only uploads the current samples.
+  /// Use this if updateSamples() is called manually or if the samples are set with
+  /// applyChanges().
+  void setExternalSampling(bool enable);
+
+  /// Returns false if update() would not sample the trail at the given time, for example because
+  /// it is evicted or its tip moved less than the configured pixel threshold. If external sampling
+  /// is enabled, updateSamples() only has to be called if this returns true. Calls to
+  /// updateSamples() of different trajectories may run in parallel.
+  bool needsSampling(double tTime) const;
+
+  /// Changes are only recorded if this is enabled. When enabled, the next call to takeChanges()
+  /// will contain all samples.
+  void setRecordChanges(bool enable);
+
+  /// Retrieves all changes since the last call.
+  void takeChanges(Changes& changes);
+
+  /// Applies changes which were retrieved from another instance with takeChanges(). If the other
+  /// instance has been evicted, this instance is evicted as well.
+  void applyChanges(Changes const& changes);
+
+  /// Returns a view of the current samples. See Plugin::TrailView for details.
+  Plugin::TrailView getView() const;
+
+  /// This changes whenever the samples or their order change.
+  uint64_t getGeneration() const;
+
+  /// A point on the trail found by intersect() or getNearestPoint().
+  struct Pick {
+    double     mTime{};     ///< The interpolated time at the point.
+    glm::dvec3 mPosition{}; ///< The point in world space.
+    double     mError{};    ///< The angle to the ray or the distance to the query position.
+  };
+
+  /// Returns the point on the trail with the smallest angular distance to the given world-space
+  /// ray, if this angle is smaller than maxAngle (in radians). Only the part of the trail which is
+  /// not faded out completely can be hit. For periodic trails, the time of the point lies within
+  /// the last period. This returns std::nullopt if the trail is not drawn currently.
+  std::optional<Pick> intersect(
+      glm::dvec3 const& rayOrigin, glm::dvec3 const& rayDirection, double maxAngle) const;
+
+  /// Returns the point on the trail which is closest to the given world-space position, if its
+  /// distance is smaller than maxDistance. See intersect() for the parts which are considered.
+  std::optional<Pick> getNearestPoint(glm::dvec3 const& position, double maxDistance) const;
+
   /// The trajectory visualizes the path of this body.
   void               setTargetCenterName(std::string const& sCenterName);
   void               setTargetFrameName(std::string const& sFrameName);
@@ -55,10 +131,106 @@ class Trajectory : public cs::scene::CelestialObject, public IVistaOpenGLDraw {
   void setCenterName(std::string const& sCenterName) override;
   void setFrameName(std::string const& sFrameName) override;
 
+  /// If a cache is set, trails which have to be sampled from scratch are loaded from the cache if
+  /// possible.
+  void setCache(std::shared_ptr<TrailCache> cache);
+
+  /// Returns an estimate of the host and GPU memory in bytes which is used for the samples of this
+  /// trail. The vertex buffer of the classic trail renderer is not included.
+  size_t getMemoryUsage() const;
+
+  /// Returns true if the trail was not drawn in the last frame and has not been evicted yet.
+  bool canBeEvicted() const;
+
+  /// Returns the last time at which the trail was drawn.
+  std::chrono::steady_clock::time_point getLastVisibleTime() const;
+
+  /// Frees all sample buffers. The trail is not sampled while it is invisible. Once it becomes
+  /// visible again, it is sampled from scratch like a newly created trail.
+  void evict();
+
+  /// Writes the current samples to the cache. This does nothing if no cache is set or if the trail
+  /// is not completely sampled yet.
+  void saveToCache() const;
+
   bool Do() override;
   bool GetBoundingBox(VistaBoundingBox& bb) override;
 
  private:
+  TrailCache::Key getCacheKey() const;
+
+  /// Uses the given chronologically ordered samples as trail if they match the current
+  /// configuration and are not too old. Returns false if the samples cannot be used.
+  bool applyCachedSamples(std::vector<glm::dvec4> const& samples, double tTime,
+      double dLengthSeconds, double dSampleLength);
+
+  /// Sampling is done in three steps: First, the required sample times are collected in
+  /// mSampleTimes. Then evaluateSamples() queries the positions (and velocities if Hermite trails
+  /// are enabled) for all of them with one call to the Ephemeris. Finally, commitSample() stores
+  /// the i-th result in the given ring-buffer slot. It returns false if there was no data
+  /// available for the sample.
+  void evaluateSamples();
+  bool commitSample(int slot, size_t i);
+
+  /// Removes all samples so that the trail is sampled from scratch in the next frame. This is
+  /// called whenever the configuration of the trail changes.
+  void clearSamples();
+
+  /// Records a changed ring-buffer slot if setRecordChanges() is enabled. This also advances the
+  /// generation of the samples.
+  void markChanged(int slot);
+  void markAllChanged();
+
+  /// Fills mTessellatedPoints with cubic Hermite segments between the samples. The number of
+  /// linear pieces per segment depends on the segment's size on screen.
+  void tessellate(double dSampleLength);
+
+  /// Returns true if the tip of the trail is estimated to have moved by less than the configured
+  /// number of pixels since it was last computed. Sampling can then be skipped in this frame.
+  bool canSkipUpdate(double tTime) const;
+
+  /// Used instead of the ring-buffer sampling for periodic trails. One full orbit is sampled once
+  /// and the tip is interpolated on this loop in each frame, so no ephemeris queries are required.
+  /// Once per sample interval, the loop is compared to the actual position of the target and
+  /// sampled again if it drifted too far.
+  void updatePeriodicSamples(double tTime);
+
+  /// Sets mTip to the position on the loop at the given time and the start of mPoints to the first
+  /// sample after the tip.
+  void updateLoopTip(double tTime);
+
+  /// Returns the largest regular time between two samples. This depends on the number of detail
+  /// levels.
+  double getMaxSampleSpacing() const;
+
+  /// Returns the time range of the samples which are not faded out completely when drawn at
+  /// mDrawTime.
+  SegmentBVH::TimeWindow getVisibleWindow() const;
+
+  /// Returns mVelocities for Hermite trails and an empty vector otherwise. This is passed to
+  /// mSegments.
+  std::vector<glm::dvec3> const& getSegmentVelocities() const;
+
+  /// Used instead of the ring-buffer sampling if there are multiple detail levels. The desired
+  /// sample times are computed for all levels and samples which already exist for these times are
+  /// reused. Only missing samples are evaluated. If the number of samples did not change, only the
+  /// slots whose samples changed are written, see placeRebinnedSamples(). Otherwise, mPoints is
+  /// replaced and starts at the first slot.
+  void rebinSamples(double tTime, double dLengthSeconds);
+
+  /// Writes the samples of mRebinnedPoints to mPoints if both have the same size. The start of the
+  /// ring is chosen so that as few slots as possible change, only these are marked as changed.
+  void placeRebinnedSamples();
+
+  /// Samples every n-th of the slots collected in mCoarseSlots so that at most maxSamples are
+  /// evaluated and linearly interpolates the others. The interpolated slots are inserted into
+  /// mPendingSamples for later refinement, stale entries are removed from it.
+  void finishCoarsePass(size_t maxSamples);
+
+  /// Replaces some of the interpolated samples with exact ones. The amount is chosen so that all
+  /// samples are exact once the warm-up duration has passed, but it will not exceed maxSamples.
+  void refinePendingSamples(size_t maxSamples);
+
   std::shared_ptr<Plugin::Settings> mPluginSettings;
   cs::scene::Trajectory             mTrajectory;
 
@@ -66,13 +238,110 @@ class Trajectory : public cs::scene::CelestialObject, public IVistaOpenGLDraw {
 
   std::string             mTargetCenter;
   std::string             mTargetFrame;
-  std::vector<glm::dvec4> mPoints;
-  int                     mStartIndex;
+  Ephemeris               mEphemeris;
+  TrailBuffer<glm::dvec4> mPoints;
+  std::vector<glm::dvec3> mVelocities;
+  std::vector<glm::dvec4> mTessellatedPoints;
   double                  mLastSampleTime{};
   double                  mLastUpdateTime;
   double                  mLastFrameTime{};
 
+  /// If samples are aligned to the global time grid, mLastSampleTime is always computed as
+  /// mLastSampleIndex * sample interval. This ensures bit-identical sample times.
+  bool    mSamplesAreAligned = false;
+  int64_t mLastSampleIndex{};
+
+  /// This is true if mPoints contains samples of multiple detail levels. mLastSampleIndex is then
+  /// the index of the newest sample in units of mRebinnedSpacing.
+  bool   mSamplesAreRebinned = false;
+  double mRebinnedSpacing{};
+
+  /// The time of the first sample of the loop of a periodic trail, the largest distance of the
+  /// loop from the parent and the time at which the loop was last checked for drift.
+  bool   mLoopIsValid = false;
+  double mLoopStart{};
+  double mLoopRadius{};
+  double mLastDriftCheck{};
+
+  std::vector<glm::dvec4> mRebinnedPoints;
+  std::vector<glm::dvec3> mRebinnedVelocities;
+
+  /// The largest distance of any sample from the parent. This is accumulated during sampling,
+  /// which may happen on other threads, and copied to pVisibleRadius in update().
+  double mVisibleRadius{};
+
+  /// This is true if mVelocities contains valid data for each sample.
+  bool mSamplesHaveVelocities = false;
+
+  /// The current position of the target. This is computed together with the samples.
+  glm::dvec3 mTip{};
+  bool       mHasTip = false;
+
+  /// The time at which mTip was computed and the velocity of the tip estimated from its last two
+  /// positions. This is used for skipping updates of slow trails.
+  double     mTipTime{};
+  glm::dvec3 mTipVelocity{};
+  bool       mHasTipVelocity = false;
+
+  /// The time at which the trail was drawn in the last frame.
+  double mDrawTime{};
+
+  /// The world transform used for the last upload of a skipped frame. If neither the samples nor
+  /// the transform changed, nothing has to be uploaded.
+  glm::dmat4 mUploadedTransform{0.0};
+
+  /// See getGeneration().
+  uint64_t mGeneration{};
+
+  bool              mExternalSampling = false;
+  bool              mWasSampled       = false;
+  bool              mRecordChanges    = false;
+  bool              mAllSlotsChanged  = false;
+  std::vector<bool> mSlotChanged;
+  std::vector<int>  mChangedSlots;
+
+  /// Used instead of mTrajectory if resident trails are enabled and Hermite trails are disabled.
+  /// It is only created once the trail is drawn this way.
+  std::unique_ptr<TrailRenderer> mRenderer;
+
+  /// A bounding volume hierarchy over the segments between the samples in mPoints. It is refitted
+  /// at the end of each update().
+  SegmentBVH mSegments;
+
+  /// Buffers for the batched sampling. They are only members to avoid allocations.
+  std::vector<double>     mSampleTimes;
+  std::vector<int>        mSampleSlots;
+  std::vector<glm::dvec3> mSamplePositions;
+  std::vector<glm::dvec3> mSampleVelocities;
+
+  /// This is updated when drawing and used for choosing the tessellation of the Hermite segments
+  /// and for estimating the on-screen motion of the tip.
+  double mPixelsPerRadian = 1000.0;
+
+  /// Ring-buffer slots and their sample times which still have to be sampled during a coarse
+  /// complete recalculation.
+  std::vector<std::pair<int, double>> mCoarseSlots;
+
+  /// The indices into mCoarseSlots which are sampled and those which were sampled successfully.
+  /// They are only used by finishCoarsePass() and kept to reuse their memory.
+  std::vector<size_t> mCoarseCandidates;
+  std::vector<size_t> mCoarseAnchors;
+
+  /// Ring-buffer slots and their sample times which currently contain interpolated data. They are
+  /// sorted by time, the newest samples are refined first.
+  std::vector<std::pair<int, double>>   mPendingSamples;
+  std::chrono::steady_clock::time_point mRefinementDeadline;
+  std::chrono::steady_clock::time_point mLastRefinementTime;
+
+  std::shared_ptr<TrailCache>          mCache;
+  std::string                          mRequestedCacheKey;
+  std::future<std::vector<glm::dvec4>> mCacheRequest;
+
   bool mTrailIsInExistence = false;
+
+  /// See evict().
+  bool                                  mIsEvicted = false;
+  std::chrono::steady_clock::time_point mLastVisibleTime;
 };
 
 } // namespace csp::trajectories
@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// This is the csp-trajectories-allocation-counter library. See AllocationCounter.hpp for details.
+
+#include "../AllocationCounter.hpp"
+
+#include <cstdlib>
+#include <new>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Each thread counts its own allocations, so that the sampling threads or the logger do not
+// disturb the measurements of the main thread.
+thread_local uint64_t allocationCount = 0;
+
+void* allocate(std::size_t size) noexcept {
+  ++allocationCount;
+  return std::malloc(size > 0 ? size : 1);
+}
+
+void* allocate(std::size_t size, std::align_val_t alignment) noexcept {
+  ++allocationCount;
+
+  void* memory = nullptr;
+  if (posix_memalign(&memory, static_cast<std::size_t>(alignment), size > 0 ? size : 1) != 0) {
+    return nullptr;
+  }
+
+  return memory;
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t cspTrajectoriesGetAllocationCount() {
+  return allocationCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void* operator new(std::size_t size) {
+  if (void* memory = allocate(size)) {
+    return memory;
+  }
+
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, std::nothrow_t const& /*tag*/) noexcept {
+  return allocate(size);
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const& /*tag*/) noexcept {
+  return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  if (void* memory = allocate(size, alignment)) {
+    return memory;
+  }
+
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void* operator new(
+    std::size_t size, std::align_val_t alignment, std::nothrow_t const& /*tag*/) noexcept {
+  return allocate(size, alignment);
+}
+
+void* operator new[](
+    std::size_t size, std::align_val_t alignment, std::nothrow_t const& /*tag*/) noexcept {
+  return allocate(size, alignment);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t /*size*/) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t /*size*/) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t /*alignment*/) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t /*alignment*/) noexcept {
+  std::free(memory);
+}
+
+void operator delete(
+    void* memory, std::size_t /*size*/, std::align_val_t /*alignment*/) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](
+    void* memory, std::size_t /*size*/, std::align_val_t /*alignment*/) noexcept {
+  std::free(memory);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                               This file is part of CosmoScout VR                               //
+//      and may be used under the terms of the MIT license. See the LICENSE file for details.     //
+//                        Copyright: (c) 2019 German Aerospace Center (DLR)                       //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// This is the csp-trajectories-ephemeris-worker executable. It is started by the EphemerisWorkers
+// of the plugin with the name of a shared memory object and a list of SPICE kernels:
+//
+//   csp-trajectories-ephemeris-worker <shared memory name> <kernel> [<kernel> ...]
+//
+// It loads the kernels and evaluates requested batches of the shared memory until the plugin
+// shuts it down or the parent process disappears. See EphemerisWorkerProtocol.hpp for details.
+
+#include "../EphemerisWorkerProtocol.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cspice/SpiceUsr.h>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace protocol = csp::trajectories::protocol;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Evaluates all times of the given batch.
+void evaluate(protocol::SharedBatch& batch) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+
+  for (uint32_t i = 0; i < batch.mCount; ++i) {
+    SpiceDouble* state = &batch.mStates[i * 6];
+    SpiceDouble  lightTime{};
+
+    if (batch.mWithVelocities) {
+      spkez_c(batch.mTargetId, batch.mTimes[i], batch.mFrame.data(), "NONE", batch.mObserverId,
+          state, &lightTime);
+    } else {
+      spkezp_c(batch.mTargetId, batch.mTimes[i], batch.mFrame.data(), "NONE", batch.mObserverId,
+          state, &lightTime);
+      std::fill(state + 3, state + 6, 0.0);
+    }
+
+    if (failed_c()) {
+      reset_c();
+      std::fill(state, state + 6, nan);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Claims a requested batch of the ring. Returns a nullptr if another worker was faster.
+protocol::SharedBatch* takeBatch(protocol::SharedState& shared, uint32_t& cursor) {
+  for (uint32_t i = 0; i < shared.mBatchCount; ++i) {
+    auto& batch    = protocol::getBatch(shared, cursor);
+    auto  expected = protocol::BatchState::eRequested;
+    cursor         = (cursor + 1) % shared.mBatchCount;
+
+    if (batch.mState.compare_exchange_strong(expected, protocol::BatchState::eEvaluating)) {
+      return &batch;
+    }
+  }
+
+  return nullptr;
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <shared memory name> <kernel> [<kernel> ...]"
+              << std::endl;
+    return 1;
+  }
+
+  int         fd = shm_open(argv[1], O_RDWR, 0);
+  struct stat info {};
+
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    std::cerr << "Failed to open shared memory '" << argv[1] << "'!" << std::endl;
+    return 1;
+  }
+
+  void* memory = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (memory == MAP_FAILED) {
+    std::cerr << "Failed to map shared memory '" << argv[1] << "'!" << std::endl;
+    return 1;
+  }
+
+  auto& shared = *static_cast<protocol::SharedState*>(memory);
+
+  if (shared.mVersion != protocol::VERSION ||
+      static_cast<size_t>(info.st_size) < protocol::getSharedSize(shared.mBatchCount)) {
+    std::cerr << "The shared memory has an incompatible layout!" << std::endl;
+    return 1;
+  }
+
+  // Errors are reported by failed_c(), nothing should be printed or abort the process.
+  erract_c("SET", 0, const_cast<SpiceChar*>("RETURN"));
+  errprt_c("SET", 0, const_cast<SpiceChar*>("NONE"));
+
+  for (int i = 2; i < argc; ++i) {
+    furnsh_c(argv[i]);
+
+    if (failed_c()) {
+      std::array<SpiceChar, 1024> message{};
+      getmsg_c("LONG", message.size(), message.data());
+      std::cerr << "Failed to load kernel '" << argv[i] << "': " << message.data() << std::endl;
+      return 1;
+    }
+  }
+
+  ++shared.mReadyWorkers;
+
+  uint32_t cursor = 0;
+
+  while (!shared.mShutdown) {
+
+    // Wake up regularly to check whether CosmoScout VR is still running.
+    timespec deadline{};
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+
+    if (sem_timedwait(&shared.mWork, &deadline) != 0) {
+      if (errno != ETIMEDOUT && errno != EINTR) {
+        return 1;
+      }
+
+      if (getppid() != shared.mParentPid) {
+        return 0;
+      }
+
+      continue;
+    }
+
+    // Each post of the work semaphore belongs to one requested batch.
+    if (auto* batch = takeBatch(shared, cursor)) {
+      evaluate(*batch);
+      batch->mState = protocol::BatchState::eDone;
+      sem_post(&batch->mDone);
+    }
+  }
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# ------------------------------------------------------------------------------------------------ #
+#                                This file is part of CosmoScout VR                                #
+#       and may be used under the terms of the MIT license. See the LICENSE file for details.      #
+#                         Copyright: (c) 2019 German Aerospace Center (DLR)                        #
+# ------------------------------------------------------------------------------------------------ #
+
+# This script starts one leader and several follower processes of CosmoScout VR on the local
+# machine. It is meant for testing the cluster synchronization of the trails (enableClusterSync).
+#
+# Usage: ./start-local-cluster.sh <install dir> <settings.json> <vista.ini> <leader section> \
+#                                 <follower section>...
+#
+# The ViSTA configuration has to define one cluster section for the leader and one for each
+# follower, all of them connecting via 127.0.0.1. The leader waits until all followers have
+# connected. The output of each process is written to cluster-<section>.log in the current
+# directory. All processes are stopped when the leader exits or when this script is interrupted.
+
+set -e
+
+if [ "$#" -lt 5 ]; then
+  echo "Usage: $0 <install dir> <settings.json> <vista.ini> <leader section> <follower section>..."
+  exit 1
+fi
+
+INSTALL_DIR="$(cd "$1" && pwd)"
+SETTINGS="$(realpath "$2")"
+VISTA_INI="$(realpath "$3")"
+LEADER="$4"
+shift 4
+
+export LD_LIBRARY_PATH="$INSTALL_DIR/lib:$LD_LIBRARY_PATH"
+cd "$INSTALL_DIR/bin"
+
+PIDS=()
+trap 'kill "${PIDS[@]}" 2>/dev/null' EXIT
+
+for FOLLOWER in "$@"; do
+  ./cosmoscout --settings="$SETTINGS" -vistaini "$VISTA_INI" -newclusterslave "$FOLLOWER" \
+    > "$OLDPWD/cluster-$FOLLOWER.log" 2>&1 &
+  PIDS+=($!)
+done
+
+./cosmoscout --settings="$SETTINGS" -vistaini "$VISTA_INI" -newclustermaster "$LEADER" \
+  2>&1 | tee "$OLDPWD/cluster-$LEADER.log"